@@ -0,0 +1,657 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host benchmark of the color area analysis.
+ *
+ * Replays NV12 frames, either recorded raw frames or synthetic ones, through
+ * the same code as the application and reports the time and number of
+ * heap allocations per frame for different resolutions, marker sizes, region
+ * counts and shapes. The modes are:
+ * - regionset: all color areas evaluated in one pass with RegionSet and
+ *   filtered with StateFilter, as done by imageanalysis(), with the tasks
+ *   spread over -j threads and the rectangles evaluated as chosen by -S
+ * - colorarea: each color area evaluated by itself with ColorArea
+ * - convert: full frame NV12 to BGR conversion, the step the analysis used
+ *   to do before evaluating the color areas
+ *
+ * With -c, a crop dump recorded by the application is replayed instead, to
+ * check how the recorded color areas are evaluated on the host.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <opencv2/imgproc.hpp>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "cropdump.hpp"
+#include "regionset.hpp"
+#include "statefilter.hpp"
+#include "taskpool.hpp"
+
+using namespace cv;
+using namespace std;
+
+#define DEFAULT_FRAMES (1000)
+#define WARMUP_FRAMES (20)
+#define SYNTHETIC_FRAMES (8)
+
+/// Number of heap allocations since start
+static atomic<size_t> allocations(0);
+
+// Count every heap allocation, including those of operator new and of the
+// OpenCV matrix allocator, by wrapping the glibc allocator. The memory still
+// comes from glibc, so free() needs no wrapper.
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+
+    void *malloc(size_t size)
+    {
+        allocations++;
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        allocations++;
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        allocations++;
+        return __libc_realloc(ptr, size);
+    }
+
+    int posix_memalign(void **ptr, size_t alignment, size_t size)
+    {
+        allocations++;
+        *ptr = __libc_memalign(alignment, size);
+        return (nullptr == *ptr) ? ENOMEM : 0;
+    }
+}
+
+enum BenchMode
+{
+    ModeRegionSet = 0,
+    ModeColorArea,
+    ModeConvert,
+    ModeCount
+};
+
+static const char *MODE_NAMES[ModeCount] = {"regionset", "colorarea", "convert"};
+static const char *SHAPE_NAMES[MarkerCount] = {"ellipse", "rectangle"};
+static const char *METRIC_NAMES[MetricTypeCount] = {"channel", "deltae76", "deltae2000", "hue"};
+static const char *STRATEGY_NAMES[StrategyCount] = {"auto", "rows", "table"};
+
+struct BenchConfig
+{
+    Size resolution;
+    uint32_t markersize;
+    size_t numregions;
+    uint8_t shape;
+    ColorMetricType metric;
+    EvaluationStrategy strategy;
+};
+
+/// NV12 frames of one resolution, stored back to back
+struct FrameSet
+{
+    Size resolution;
+    vector<uint8_t> data;
+    size_t count;
+};
+
+static void usage(const char *name)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "  -r WxH[,WxH...]   Resolutions (default 640x360,1280x720,1920x1080)\n"
+        "  -m N[,N...]       Marker widths and heights in pixels (default 25,100)\n"
+        "  -n N[,N...]       Number of color areas (default 1,8,64)\n"
+        "  -s SHAPE[,...]    Shapes: ellipse, rectangle (default both)\n"
+        "  -M MODE[,...]     Modes: regionset, colorarea, convert (default all)\n"
+        "  -S STRATEGY[,...] Rectangle evaluation of the regionset mode: auto, rows,\n"
+        "                    table (default auto)\n"
+        "  -d METRIC         Metric: channel, deltae76, deltae2000, hue (default channel)\n"
+        "  -f N              Number of timed frames per run (default %d)\n"
+        "  -j N              Threads evaluating the regionset mode (default 1)\n"
+        "  -i FILE           Replay raw NV12 frames from FILE, needs one -r\n"
+        "  -c FILE           Replay the crop dump FILE with the regionset mode, with\n"
+        "                    its resolution, color areas and metric (unless -d)\n"
+        "  -z                Fail if a timed frame in the regionset or colorarea\n"
+        "                    mode allocates heap memory\n",
+        name,
+        DEFAULT_FRAMES);
+}
+
+static vector<string> split(const string &str)
+{
+    vector<string> items;
+    istringstream stream(str);
+    string item;
+    while (getline(stream, item, ','))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+static bool parse_resolutions(const string &str, vector<Size> &resolutions)
+{
+    resolutions.clear();
+    for (auto &item : split(str))
+    {
+        unsigned int w, h;
+        if (2 != sscanf(item.c_str(), "%ux%u", &w, &h) || 0 == w || 0 == h || 0 != (w | h) % 2)
+        {
+            fprintf(stderr, "Invalid resolution %s\n", item.c_str());
+            return false;
+        }
+        resolutions.push_back(Size(w, h));
+    }
+    return !resolutions.empty();
+}
+
+static bool parse_numbers(const string &str, vector<size_t> &numbers)
+{
+    numbers.clear();
+    for (auto &item : split(str))
+    {
+        char *end;
+        const unsigned long value = strtoul(item.c_str(), &end, 10);
+        if ('\0' != *end || 0 == value)
+        {
+            fprintf(stderr, "Invalid number %s\n", item.c_str());
+            return false;
+        }
+        numbers.push_back(value);
+    }
+    return !numbers.empty();
+}
+
+static bool parse_names(const string &str, const char *const *names, const size_t count, vector<size_t> &selected)
+{
+    selected.clear();
+    for (auto &item : split(str))
+    {
+        const size_t index = find(names, names + count, item) - names;
+        if (count == index)
+        {
+            fprintf(stderr, "Invalid name %s\n", item.c_str());
+            return false;
+        }
+        selected.push_back(index);
+    }
+    return !selected.empty();
+}
+
+/**
+ * brief Fill a frame set with synthetic frames.
+ *
+ * The frames have a gradient with some noise, so the averages differ between
+ * frames and areas like in a real scene.
+ */
+static void make_synthetic_frames(const Size &resolution, FrameSet &frames)
+{
+    const size_t framesize = resolution.area() * 3 / 2;
+    frames.resolution = resolution;
+    frames.count = SYNTHETIC_FRAMES;
+    frames.data.resize(framesize * frames.count);
+    uint32_t seed = 12345;
+    for (size_t f = 0; f < frames.count; f++)
+    {
+        uint8_t *frame = &frames.data[f * framesize];
+        for (int y = 0; y < resolution.height * 3 / 2; y++)
+        {
+            for (int x = 0; x < resolution.width; x++)
+            {
+                seed = seed * 1103515245 + 12345;
+                frame[y * resolution.width + x] = (x + y + f * 7 + ((seed >> 16) & 0x1f)) & 0xff;
+            }
+        }
+    }
+}
+
+static bool load_frames(const string &filename, const Size &resolution, FrameSet &frames)
+{
+    ifstream file(filename.c_str(), ios::binary);
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s\n", filename.c_str());
+        return false;
+    }
+    frames.resolution = resolution;
+    frames.data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    const size_t framesize = resolution.area() * 3 / 2;
+    frames.count = frames.data.size() / framesize;
+    if (0 == frames.count)
+    {
+        fprintf(
+            stderr,
+            "%s holds no complete %dx%d NV12 frame\n",
+            filename.c_str(),
+            resolution.width,
+            resolution.height);
+        return false;
+    }
+    return true;
+}
+
+/// Spread the color areas evenly over the frame
+static void make_specs(const BenchConfig &config, vector<RegionSpec> &specs)
+{
+    specs.clear();
+    size_t columns = 1;
+    while (columns * columns < config.numregions)
+    {
+        columns++;
+    }
+    const size_t rows = (config.numregions + columns - 1) / columns;
+    for (size_t i = 0; i < config.numregions; i++)
+    {
+        RegionSpec spec;
+        spec.center.x = (2 * (i % columns) + 1) * config.resolution.width / (2 * columns);
+        spec.center.y = (2 * (i / columns) + 1) * config.resolution.height / (2 * rows);
+        spec.color = Scalar(128, 128, 128);
+        spec.markerwidth = config.markersize;
+        spec.markerheight = config.markersize;
+        spec.markershape = config.shape;
+        spec.tolerance = 35;
+        spec.channel = DEFAULT_CHANNEL;
+        specs.push_back(spec);
+    }
+}
+
+/**
+ * brief Run one benchmark configuration.
+ *
+ * param pool Pool running the tasks of the regionset mode.
+ * param allocs Set to the number of heap allocations in the timed frames.
+ * return Number of color areas within tolerance, to keep the work from being
+ *        optimized away.
+ */
+static size_t run(
+    const BenchMode mode,
+    const BenchConfig &config,
+    const FrameSet &frames,
+    const size_t numframes,
+    TaskPool &pool,
+    size_t &allocs)
+{
+    const Size &res = config.resolution;
+    const size_t framesize = res.area() * 3 / 2;
+    vector<RegionSpec> specs;
+    make_specs(config, specs);
+    RegionSet regionset(res, specs);
+    regionset.SetMetric(config.metric);
+    regionset.SetStrategy(config.strategy);
+    // Buffers are set up front, like the analysis does at stream setup
+    vector<RegionResult> results;
+    results.reserve(MAX_REGIONS);
+    StateFilter filters[MAX_REGIONS];
+    FilterConfig filterconfig = {4, 5, 0};
+    for (auto &filter : filters)
+    {
+        filter.Configure(filterconfig);
+    }
+    Mat nv12_mat(res.height * 3 / 2, res.width, CV_8UC1);
+    Mat bgr_mat(res.height, res.width, CV_8UC3);
+    size_t matches = 0;
+
+    size_t startallocs = 0;
+    chrono::steady_clock::time_point start;
+    for (size_t i = 0; i < WARMUP_FRAMES + numframes; i++)
+    {
+        if (WARMUP_FRAMES == i)
+        {
+            startallocs = allocations;
+            start = chrono::steady_clock::now();
+        }
+        // Point the Mat at the frame, like FrameHandle::Nv12() wraps the VDO buffer for imageanalysis()
+        nv12_mat.data = const_cast<uint8_t *>(&frames.data[(i % frames.count) * framesize]);
+        switch (mode)
+        {
+        case ModeRegionSet:
+            regionset.Evaluate(nv12_mat, results, &pool);
+            for (size_t r = 0; r < results.size(); r++)
+            {
+                const ColorArea &region = regionset.Region(r);
+                const Scalar &smoothed = filters[r].Smooth(results[r].average);
+                matches += filters[r].Update(region.Deviation(smoothed), region.GetTolerance(), i);
+            }
+            break;
+        case ModeColorArea:
+            for (size_t r = 0; r < regionset.Size(); r++)
+            {
+                matches += regionset.Region(r).ColorAreaValueWithinTolerance(nv12_mat);
+            }
+            break;
+        case ModeConvert:
+            cvtColor(nv12_mat, bgr_mat, COLOR_YUV2BGR_NV12);
+            matches += bgr_mat.data[0] & 1;
+            break;
+        default:
+            assert(false);
+        }
+    }
+    const chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    allocs = allocations - startallocs;
+
+    // The strategy asked for, and what it chose for the rectangles
+    string evaluation = "-";
+    if (ModeRegionSet == mode)
+    {
+        evaluation = string(STRATEGY_NAMES[config.strategy]) + ":" + (regionset.UsesSummedArea() ? "table" : "rows");
+    }
+
+    const double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / double(numframes);
+    fprintf(
+        stderr,
+        "%-10s %-10s %-11s %5dx%-5d %6u %7zu %12.0f %10.1f %12.2f\n",
+        MODE_NAMES[mode],
+        (ModeConvert == mode) ? "-" : SHAPE_NAMES[config.shape],
+        evaluation.c_str(),
+        res.width,
+        res.height,
+        config.markersize,
+        config.numregions,
+        ns,
+        1e9 / ns,
+        allocs / double(numframes));
+    return matches;
+}
+
+/**
+ * brief Replay a crop dump and compare the states with the recorded ones.
+ *
+ * The crops are put on a mid gray frame, which is only seen by the summed-area
+ * table outside the rectangles, so the color areas are evaluated on the
+ * samples they were evaluated on when recording.
+ *
+ * param filename The crop dump.
+ * param metric The metric to evaluate with, or MetricTypeCount for the one
+ *        of the dump.
+ * param strategies Rectangle evaluations to replay with.
+ * param pool Threads evaluating the color areas.
+ * return True if the dump was replayed.
+ */
+static bool replay_crop_dump(
+    const string &filename,
+    const size_t metric,
+    const vector<size_t> &strategies,
+    TaskPool &pool)
+{
+    CropDumpReader dump;
+    if (!dump.Open(filename))
+    {
+        return false;
+    }
+    const CropDumpHeader &header = dump.Header();
+    const Size res(header.width, header.height);
+    vector<RegionSpec> specs;
+    dump.GetSpecs(specs);
+    if (specs.empty() || 0 == dump.Frames())
+    {
+        fprintf(stderr, "%s holds no color areas or no frames\n", filename.c_str());
+        return false;
+    }
+    const size_t dumpmetric = (MetricTypeCount > header.metric) ? header.metric : size_t(MetricChannel);
+    const ColorMetricType replaymetric = static_cast<ColorMetricType>((MetricTypeCount > metric) ? metric : dumpmetric);
+    fprintf(
+        stderr,
+        "%s: %dx%d, %zu color areas, %zu frames, recorded with %s, replayed with %s\n",
+        filename.c_str(),
+        res.width,
+        res.height,
+        specs.size(),
+        dump.Frames(),
+        METRIC_NAMES[dumpmetric],
+        METRIC_NAMES[replaymetric]);
+
+    Mat nv12_mat(res.height * 3 / 2, res.width, CV_8UC1, Scalar(128));
+    vector<RegionResult> results;
+    results.reserve(MAX_REGIONS);
+    for (auto strategy : strategies)
+    {
+        RegionSet regionset(res, specs);
+        regionset.SetMetric(replaymetric);
+        regionset.SetStrategy(static_cast<EvaluationStrategy>(strategy));
+        size_t agreed[MAX_REGIONS] = {};
+        size_t recordedwithin[MAX_REGIONS] = {};
+        size_t replayedwithin[MAX_REGIONS] = {};
+        size_t replayed = 0;
+        chrono::steady_clock::duration evaluating(0);
+        for (size_t f = 0; f < dump.Frames(); f++)
+        {
+            const CropDumpFrame *frame = dump.Render(f, nv12_mat);
+            if (nullptr == frame)
+            {
+                // Being written when the dump was copied
+                continue;
+            }
+            const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            regionset.Evaluate(nv12_mat, results, &pool);
+            evaluating += chrono::steady_clock::now() - start;
+            replayed++;
+            for (size_t r = 0; r < results.size(); r++)
+            {
+                const bool recorded = 0 != (frame->states[r] & StateWithin);
+                agreed[r] += recorded == results[r].withintolerance;
+                recordedwithin[r] += recorded;
+                replayedwithin[r] += results[r].withintolerance;
+            }
+        }
+        if (0 == replayed)
+        {
+            fprintf(stderr, "%s holds no complete frames\n", filename.c_str());
+            return false;
+        }
+
+        const double ns = chrono::duration_cast<chrono::nanoseconds>(evaluating).count() / double(replayed);
+        fprintf(
+            stderr,
+            "evaluation %s:%s, %zu frames, %.0f ns/frame, %.1f frames/s\n",
+            STRATEGY_NAMES[strategy],
+            regionset.UsesSummedArea() ? "table" : "rows",
+            replayed,
+            ns,
+            1e9 / ns);
+        for (size_t r = 0; r < specs.size(); r++)
+        {
+            fprintf(
+                stderr,
+                "  area %2zu: %6.2f%% agreed, within tolerance in %zu recorded and %zu replayed frames\n",
+                r,
+                100.0 * agreed[r] / replayed,
+                recordedwithin[r],
+                replayedwithin[r]);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    vector<Size> resolutions;
+    vector<size_t> markersizes;
+    vector<size_t> numregions;
+    vector<size_t> shapes;
+    vector<size_t> modes;
+    vector<size_t> metrics;
+    vector<size_t> strategies;
+    size_t numframes = DEFAULT_FRAMES;
+    size_t numthreads = 1;
+    bool noallocs = false;
+    bool metricgiven = false;
+    string filename;
+    string dumpname;
+    parse_resolutions("640x360,1280x720,1920x1080", resolutions);
+    parse_numbers("25,100", markersizes);
+    parse_numbers("1,8,64", numregions);
+    parse_names("ellipse,rectangle", SHAPE_NAMES, MarkerCount, shapes);
+    parse_names("regionset,colorarea,convert", MODE_NAMES, ModeCount, modes);
+    parse_names("channel", METRIC_NAMES, MetricTypeCount, metrics);
+    parse_names("auto", STRATEGY_NAMES, StrategyCount, strategies);
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "r:m:n:s:M:S:d:f:j:i:c:zh")))
+    {
+        bool ok = true;
+        vector<size_t> frames;
+        switch (opt)
+        {
+        case 'r':
+            ok = parse_resolutions(optarg, resolutions);
+            break;
+        case 'm':
+            ok = parse_numbers(optarg, markersizes);
+            break;
+        case 'n':
+            ok = parse_numbers(optarg, numregions);
+            ok = ok && MAX_REGIONS >= *max_element(numregions.begin(), numregions.end());
+            break;
+        case 's':
+            ok = parse_names(optarg, SHAPE_NAMES, MarkerCount, shapes);
+            break;
+        case 'M':
+            ok = parse_names(optarg, MODE_NAMES, ModeCount, modes);
+            break;
+        case 'S':
+            ok = parse_names(optarg, STRATEGY_NAMES, StrategyCount, strategies);
+            break;
+        case 'd':
+            ok = parse_names(optarg, METRIC_NAMES, MetricTypeCount, metrics) && 1 == metrics.size();
+            metricgiven = true;
+            break;
+        case 'f':
+            ok = parse_numbers(optarg, frames);
+            numframes = ok ? frames[0] : numframes;
+            break;
+        case 'j':
+            ok = parse_numbers(optarg, frames) && 0 < frames[0] && MAX_POOL_THREADS >= frames[0];
+            numthreads = ok ? frames[0] : numthreads;
+            break;
+        case 'i':
+            filename = optarg;
+            break;
+        case 'c':
+            dumpname = optarg;
+            break;
+        case 'z':
+            noallocs = true;
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!filename.empty() && 1 != resolutions.size())
+    {
+        fprintf(stderr, "Replaying %s needs exactly one resolution\n", filename.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!dumpname.empty())
+    {
+        fprintf(stderr, "threads: %zu\n", numthreads);
+        TaskPool pool(numthreads - 1);
+        const size_t metric = metricgiven ? metrics[0] : size_t(MetricTypeCount);
+        return replay_crop_dump(dumpname, metric, strategies, pool) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // The results go to stderr, since the color areas log their setup to stdout
+    fprintf(stderr, "metric: %s, threads: %zu\n", METRIC_NAMES[metrics[0]], numthreads);
+    TaskPool pool(numthreads - 1);
+    fprintf(
+        stderr,
+        "%-10s %-10s %-11s %11s %6s %7s %12s %10s %12s\n",
+        "mode",
+        "shape",
+        "evaluation",
+        "resolution",
+        "marker",
+        "regions",
+        "ns/frame",
+        "frames/s",
+        "allocs/frame");
+    size_t matches = 0;
+    size_t allocatingruns = 0;
+    for (auto &resolution : resolutions)
+    {
+        FrameSet frames;
+        if (filename.empty())
+        {
+            make_synthetic_frames(resolution, frames);
+        }
+        else if (!load_frames(filename, resolution, frames))
+        {
+            return EXIT_FAILURE;
+        }
+        for (auto mode : modes)
+        {
+            // The conversion does not depend on the color areas
+            const size_t numshapes = (ModeConvert == mode) ? 1 : shapes.size();
+            const size_t nummarkers = (ModeConvert == mode) ? 1 : markersizes.size();
+            const size_t numcounts = (ModeConvert == mode) ? 1 : numregions.size();
+            // Only the regionset mode has strategies, each count is run with all of them
+            const size_t numstrategies = (ModeRegionSet == mode) ? strategies.size() : 1;
+            for (size_t s = 0; s < numshapes; s++)
+            {
+                for (size_t m = 0; m < nummarkers; m++)
+                {
+                    for (size_t n = 0; n < numcounts * numstrategies; n++)
+                    {
+                        BenchConfig config;
+                        config.resolution = resolution;
+                        config.markersize = markersizes[m];
+                        config.numregions = numregions[n / numstrategies];
+                        config.shape = shapes[s];
+                        config.metric = static_cast<ColorMetricType>(metrics[0]);
+                        config.strategy = static_cast<EvaluationStrategy>(strategies[n % numstrategies]);
+                        size_t allocs;
+                        matches += run(static_cast<BenchMode>(mode), config, frames, numframes, pool, allocs);
+                        // The conversion is only a reference, it is not done by the analysis
+                        allocatingruns += (ModeConvert != mode && 0 < allocs);
+                    }
+                }
+            }
+        }
+    }
+    fprintf(stderr, "%zu matches\n", matches);
+    if (noallocs && 0 < allocatingruns)
+    {
+        fprintf(stderr, "%zu runs allocated heap memory in the timed frames\n", allocatingruns);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -21,6 +21,8 @@ const paramseturl = parambaseurl + 'update&' + paramappname + '.';
 const appbaseurl = '/local/' + paramappname.toLowerCase() + '/';
 const getstatusurl = appbaseurl + 'getstatus.cgi';
 const getstatusinterval = 1000;
+// State change counter of the latest status, the next request waits for it to change
+var statuschanges = null;
 const pickcurrenturl = appbaseurl + 'pickcurrent.cgi';
 
 const Shape = {
@@ -45,13 +47,16 @@ function setStatus(status) {
 }
 
 function updateStatus() {
-	$.get(getstatusurl)
+	const url = (null === statuschanges) ? getstatusurl : getstatusurl + '?changes=' + statuschanges;
+	$.get(url)
 		.done(function (data) {
 			setStatus(data.status);
-			setTimeout(updateStatus, getstatusinterval);
+			statuschanges = data.changes;
+			updateStatus();
 		})
 		.fail(function (jqXHR, textStatus, errorThrown) {
 			console.log('FAILED to get status. (' + errorThrown + ')');
+			statuschanges = null;
 			setTimeout(updateStatus, getstatusinterval);
 		});
 }
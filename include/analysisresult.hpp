@@ -0,0 +1,59 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "regionset.hpp"
+#include "snapshot.hpp"
+#include "spscring.hpp"
+
+/// Number of analysis results that can wait for a publishing stage
+#define RESULT_QUEUE_SIZE (16)
+
+/// Latest evaluation of one color area
+struct ColorAreaReading
+{
+    double red;
+    double green;
+    double blue;
+    /// Measured minus target color
+    double reddiff;
+    double greendiff;
+    double bluediff;
+    bool withintolerance;
+};
+
+/// Result of analyzing one frame, with the latest readings of the other
+/// channels, published by the analysis thread of the frame's channel
+struct AnalysisResult
+{
+    uint64_t frame;
+    /// Number of frames where the state of some color area changed
+    uint64_t statechanges;
+    /// Wall clock time of the evaluation, microseconds since the Unix epoch
+    int64_t timestamp;
+    /// Time from receiving the frame to the result being ready, in ms
+    double latency;
+    uint32_t numcolorareas;
+    ColorAreaReading colorareas[MAX_REGIONS];
+};
+
+typedef Snapshot<AnalysisResult> AnalysisSnapshot;
+/// Results in order, from the analysis threads to one publishing stage. The
+/// analysis threads take turns pushing, in frame order.
+typedef SpscRing<AnalysisResult, RESULT_QUEUE_SIZE> AnalysisQueue;
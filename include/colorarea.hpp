@@ -18,6 +18,9 @@
 
 #include <opencv2/core/mat.hpp>
 #include <opencv2/core/types.hpp>
+#include <vector>
+
+#include "colormetric.hpp"
 
 enum ColorComponent
 {
@@ -26,37 +29,118 @@ enum ColorComponent
     R
 };
 
+enum MarkerShape
+{
+    Ellipse = 0,
+    Rectangle,
+    MarkerCount
+};
+
+/// Layouts of the frames a color area can be evaluated on
+enum PixelFormat
+{
+    FormatNV12 = 0,
+    FormatCount
+};
+
+/// Running sums of the NV12 samples covered by a color area
+struct YuvSums
+{
+    uint64_t y;
+    uint64_t u;
+    uint64_t v;
+    uint64_t count;
+};
+
+class ColorArea;
+
+/**
+ * brief The functions evaluating one color area, specialized at compile time
+ * for its shape, pixel format and metric.
+ */
+struct RegionKernel
+{
+    /// Add the samples of the color area in frame rows [firstrow, endrow)
+    void (*sumrows)(const ColorArea &area, const cv::Mat &img, const int firstrow, const int endrow, YuvSums &sums);
+    /// Get the distance of an average color from the target
+    double (*distance)(const cv::Scalar &target, const cv::Scalar &avg);
+};
+
+/**
+ * A color area is evaluated directly on NV12 frames; only the Y and UV samples
+ * inside the crop window are read, averaged in YUV and the mean is converted to
+ * BGR. This avoids a full frame color conversion for every analyzed frame.
+ *
+ * The shape of a color area is described by one horizontal span of columns per
+ * row of its crop. Subclasses only compute the spans, which then drive both the
+ * averaging and the debug overlay.
+ *
+ * The averaging and the distance to the target go through a RegionKernel, one
+ * per shape, pixel format and metric, which is resolved when the color area is
+ * set up or its metric changes. The per frame loops thereby make no virtual
+ * calls and check no types, and a rectangle does not even look up its spans.
+ */
 class ColorArea
 {
   public:
     ColorArea(
-        const cv::Mat &img,
+        const MarkerShape shape,
+        const cv::Size &img_size,
         const cv::Point &point_center,
         const cv::Scalar &color,
         const uint32_t markerwidth,
         const uint32_t markerheight,
         const uint8_t tolerance);
     virtual ~ColorArea();
-    bool ColorAreaValueWithinTolerance(const cv::Mat &img) const;
-    cv::Scalar GetAverageColor(const cv::Mat &img) const;
+    bool ColorAreaValueWithinTolerance(const cv::Mat &nv12_img) const;
+    cv::Scalar GetAverageColor(const cv::Mat &nv12_img) const;
+    /// Add the samples of the color area in frame rows [firstrow, endrow)
+    void SumRows(const cv::Mat &img, const int firstrow, const int endrow, YuvSums &sums) const
+    {
+        kernel->sumrows(*this, img, firstrow, endrow, sums);
+    }
+    bool WithinTolerance(const cv::Scalar &avg) const;
+    double Deviation(const cv::Scalar &avg) const;
+    cv::Range GetRowRange() const;
+    cv::Range GetColumnRange() const;
+    const cv::Scalar &GetColor() const;
+    uint8_t GetTolerance() const;
+    void SetTarget(const cv::Scalar &color, const uint8_t tolerance);
+    void SetMetric(const ColorMetricType type);
+    static cv::Scalar AverageColor(const YuvSums &sums);
+    static const RegionKernel &
+    ResolveKernel(const MarkerShape shape, const PixelFormat format, const ColorMetricType metric);
+    void DrawMarker(cv::Mat &bgr_img) const;
+#if defined(DEBUG_WRITE)
+    void WriteDebugImages(const cv::Mat &bgr_img) const;
+#endif
 
   protected:
-    cv::Mat colorarea_mask;
+    /// Columns covered by the color area, one range per row of the crop
+    std::vector<cv::Range> rowspans;
     cv::Point point_center;
     cv::Range croprange_x;
     cv::Range croprange_y;
     cv::Scalar color;
+    MarkerShape shape;
+    PixelFormat format;
+    const RegionKernel *kernel;
     cv::Size img_size;
     uint32_t markerwidth;
     uint32_t markerheight;
     uint8_t tolerance;
+
+  private:
+    template <MarkerShape Shape, PixelFormat Format>
+    static void
+    SumRowsOf(const ColorArea &area, const cv::Mat &img, const int firstrow, const int endrow, YuvSums &sums);
 };
 
 class ColorAreaEllipse : public ColorArea
 {
   public:
     ColorAreaEllipse(
-        const cv::Mat &img,
+        const cv::Size &img_size,
         const cv::Point &point_center,
         const cv::Scalar &color,
         const uint32_t markerwidth,
@@ -68,7 +152,7 @@ class ColorAreaRectangle : public ColorArea
 {
   public:
     ColorAreaRectangle(
-        const cv::Mat &img,
+        const cv::Size &img_size,
         const cv::Point &point_center,
         const cv::Scalar &color,
         const uint32_t markerwidth,
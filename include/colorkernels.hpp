@@ -0,0 +1,28 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Kernels summing NV12 samples. NEON is used when available (armv7hf and
+ * aarch64 builds), otherwise plain C++.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "colorarea.hpp"
+
+void SumRowNV12(const uint8_t *y_row, const uint8_t *uv_row, int start, int end, YuvSums &sums);
@@ -0,0 +1,89 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <opencv2/core/types.hpp>
+
+/// Ways of measuring how far an average color is from the target
+enum ColorMetricType
+{
+    MetricChannel = 0,
+    MetricDeltaE76,
+    MetricDeltaE2000,
+    MetricHue,
+    MetricTypeCount
+};
+
+/*
+ * The metrics below give the distance between two BGR colors, which is
+ * compared against the tolerance. A metric is only applied to the mean color
+ * of a color area, never per pixel, so even the perceptual metrics add a
+ * constant cost per color area and frame. The metrics are stateless, and
+ * MetricDistance() picks one at compile time.
+ */
+
+/// Largest absolute difference of the R, G and B channels
+class ChannelMetric
+{
+  public:
+    static double Compute(const cv::Scalar &target, const cv::Scalar &avg);
+};
+
+/// CIE 1976 color difference, the euclidean distance in CIELAB
+class DeltaE76Metric
+{
+  public:
+    static double Compute(const cv::Scalar &target, const cv::Scalar &avg);
+};
+
+/// CIEDE2000 color difference, which corrects CIELAB for perceptual uniformity
+class DeltaE2000Metric
+{
+  public:
+    static double Compute(const cv::Scalar &target, const cv::Scalar &avg);
+};
+
+/// Difference of the HSV hue in degrees, independent of brightness
+class HueMetric
+{
+  public:
+    static double Compute(const cv::Scalar &target, const cv::Scalar &avg);
+};
+
+/**
+ * brief Distance between two BGR colors, with the metric fixed at compile time.
+ */
+template <ColorMetricType Type> double MetricDistance(const cv::Scalar &target, const cv::Scalar &avg)
+{
+    static_assert(MetricTypeCount > Type, "unknown metric");
+    if constexpr (MetricDeltaE76 == Type)
+    {
+        return DeltaE76Metric::Compute(target, avg);
+    }
+    else if constexpr (MetricDeltaE2000 == Type)
+    {
+        return DeltaE2000Metric::Compute(target, avg);
+    }
+    else if constexpr (MetricHue == Type)
+    {
+        return HueMetric::Compute(target, avg);
+    }
+    else
+    {
+        return ChannelMetric::Compute(target, avg);
+    }
+}
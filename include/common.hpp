@@ -16,16 +16,34 @@
 
 #pragma once
 
-#include <stdio.h>
 #include <syslog.h>
 
-// clang-format off
-#define LOG(type, fmt, ...) { syslog(type, fmt, ##__VA_ARGS__); printf(fmt, ##__VA_ARGS__); printf("\n"); }
-#define LOG_I(fmt, ...) { LOG(LOG_INFO, fmt, ##__VA_ARGS__) }
-#define LOG_E(fmt, ...) { LOG(LOG_ERR, fmt, ##__VA_ARGS__) }
+#include "log.hpp"
+
+// Most verbose syslog priority compiled in, the LOG_* calls above it are
+// removed by the compiler
+#if !defined(LOG_LEVEL)
 #if defined(DEBUG_WRITE)
-#define LOG_D(fmt, ...) { LOG(LOG_DEBUG, fmt, ##__VA_ARGS__) }
+#define LOG_LEVEL LOG_DEBUG
 #else
-#define LOG_D(fmt, ...)
+#define LOG_LEVEL LOG_INFO
+#endif
 #endif
+
+// clang-format off
+#define LOG(type, fmt, ...) { if (LOG_LEVEL >= (type)) { Log::Write(type, fmt, ##__VA_ARGS__); } }
+// Log at most once per LOG_LIMIT_MS from this call site
+#define LOG_LIMITED(type, fmt, ...) { \
+    static LogRateLimit limit_; \
+    unsigned suppressed_; \
+    if (LOG_LEVEL >= (type) && limit_.Allow(suppressed_)) { \
+        if (0 < suppressed_) { LOG(type, fmt " (%u similar suppressed)", ##__VA_ARGS__, suppressed_) } \
+        else { LOG(type, fmt, ##__VA_ARGS__) } \
+    } \
+}
+#define LOG_I(fmt, ...) { LOG(LOG_INFO, fmt, ##__VA_ARGS__) }
+#define LOG_E(fmt, ...) { LOG(LOG_ERR, fmt, ##__VA_ARGS__) }
+#define LOG_I_LIMITED(fmt, ...) { LOG_LIMITED(LOG_INFO, fmt, ##__VA_ARGS__) }
+// Debug messages may come from every frame, so they are always rate limited
+#define LOG_D(fmt, ...) { LOG_LIMITED(LOG_DEBUG, fmt, ##__VA_ARGS__) }
 // clang-format on
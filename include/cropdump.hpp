@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <opencv2/core/mat.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "colormetric.hpp"
+#include "regionset.hpp"
+
+#define CROP_DUMP_MAGIC (0x504d4443) // "CDMP"
+#define CROP_DUMP_VERSION (1)
+/// Largest crop dump file, fewer frames are kept if the crops need more
+#define CROP_DUMP_MAX_BYTES (32 << 20)
+
+/// Bits of the state of a color area recorded with a frame
+enum CropDumpState
+{
+    /// Within tolerance in this frame only
+    StateWithin = 1 << 0,
+    /// Within tolerance as reported, after smoothing and hysteresis
+    StateReported = 1 << 1
+};
+
+/// A color area of a crop dump, in the resolution of the analyzed stream
+struct CropDumpRegion
+{
+    int32_t centerx;
+    int32_t centery;
+    uint32_t markerwidth;
+    uint32_t markerheight;
+    uint32_t shape;
+    uint32_t tolerance;
+    /// Target color, B, G and R
+    double color[3];
+    /// Box of the stored samples, with even corners so that it covers whole
+    /// UV pairs
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    /// Offset of the samples in a slot, the Y rows followed by the UV rows
+    uint32_t offset;
+    uint32_t reserved;
+};
+
+/// Start of a crop dump file, followed by the slots
+struct CropDumpHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t metric;
+    uint32_t numregions;
+    uint32_t numslots;
+    uint32_t slotsize;
+    /// Number of frames written, the next one goes to slot written % numslots
+    uint64_t written;
+    CropDumpRegion regions[MAX_REGIONS];
+};
+
+/// Start of a slot, followed by the crops
+struct CropDumpFrame
+{
+    /// Number of the frame in the dump, UINT64_MAX while it is written
+    uint64_t sequence;
+    /// Monotonic time in us when the frame was received
+    int64_t timestamp;
+    /// CropDumpState bits of each color area
+    uint8_t states[MAX_REGIONS];
+};
+
+/**
+ * brief Ring of the latest crops of the color areas, in a memory-mapped file.
+ *
+ * Only the samples inside the crop of each color area are kept, so the ring
+ * is small enough to hold many frames, and since the file is shared the
+ * frames are there even if the application stops unexpectedly. The
+ * colorbench tool replays a dump with -c.
+ */
+class CropDump
+{
+  public:
+    CropDump();
+    ~CropDump();
+    bool Open(
+        const std::string &path,
+        const cv::Size &img_size,
+        const RegionSet &regionset,
+        const std::vector<RegionSpec> &specs,
+        const ColorMetricType metric,
+        const uint32_t numslots);
+    void Close();
+    bool IsOpen() const;
+    void Write(const cv::Mat &nv12_img, const uint8_t *states, const int64_t timestamp);
+
+  private:
+    int fd;
+    uint8_t *map;
+    size_t mapsize;
+};
+
+/**
+ * brief Read access to a crop dump, e.g. one copied off a device.
+ */
+class CropDumpReader
+{
+  public:
+    CropDumpReader();
+    ~CropDumpReader();
+    bool Open(const std::string &path);
+    const CropDumpHeader &Header() const;
+    size_t Frames() const;
+    void GetSpecs(std::vector<RegionSpec> &specs) const;
+    const CropDumpFrame *Render(const size_t frame, cv::Mat &nv12_img) const;
+
+  private:
+    int fd;
+    const uint8_t *map;
+    size_t mapsize;
+};
@@ -23,15 +23,46 @@
 #include <axevent.h>
 #include <string>
 
+#include "regionset.hpp"
+
+/**
+ * brief Stateful events of the color areas.
+ *
+ * The key/value sets of the two states are built once and reused for every
+ * event. With an interval set, at most one event per color area is sent per
+ * interval; the state changes within it are coalesced into one event with
+ * the final state, sent when the interval has passed. All methods are to be
+ * called from the main loop.
+ */
 class AxEventHandler
 {
   public:
     AxEventHandler();
     ~AxEventHandler();
-    void Send(const gboolean active) const;
+    void SetNumColorAreas(const size_t count);
+    void SetInterval(const uint32_t interval_ms);
+    void Send(const size_t index, const gboolean active);
 
   private:
+    void Declare(const size_t index);
+    void Undeclare(const size_t index);
+    void SendNow(const size_t index, const bool active);
+    void ScheduleFlush(const int64_t due);
+    static gboolean FlushEntry(gpointer data);
     AXEventHandler *evhandler;
-    bool initialized;
-    guint eventid;
+    size_t numcolorareas;
+    /// Key/value set of an event with active FALSE and TRUE
+    AXEventKeyValueSet *statesets[2];
+    int64_t interval_us;
+    /// Pending timer and when it fires, in monotonic time
+    guint flushtimer;
+    int64_t flushdue;
+    /// One stateful event declaration per color area
+    bool initialized[MAX_REGIONS];
+    guint eventid[MAX_REGIONS];
+    /// Last state sent, when it was sent and whether a newer one waits
+    bool sentstate[MAX_REGIONS];
+    int64_t senttime[MAX_REGIONS];
+    bool pending[MAX_REGIONS];
+    bool pendingstate[MAX_REGIONS];
 };
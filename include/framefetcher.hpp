@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file handles the fetching of frames from all VDO streams.
+ */
+
+#pragma once
+
+#include <atomic>
+
+class ImgProvider;
+
+/// Largest number of image providers fetched from at the same time
+#define MAX_FETCHED_STREAMS (8)
+
+/**
+ * brief One thread fetching the frames of all image providers.
+ *
+ * Instead of one thread blocking on each VDO stream, the streams are
+ * non-blocking and a single thread polls the file descriptors of all of them,
+ * fetching a frame from each stream that has one. Fetching a frame only swaps
+ * buffers, so one thread keeps up with many streams and the cores are left to
+ * the analysis. An eventfd wakes the thread up when the set of providers
+ * changes or a provider is stopped.
+ */
+class FrameFetcher
+{
+  public:
+    static bool Add(ImgProvider &provider);
+    static void Remove(ImgProvider &provider);
+    static void Wake();
+
+  private:
+    static void *threadEntry(void *data);
+};
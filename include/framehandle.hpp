@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <opencv2/core/mat.hpp>
+
+#include "imgprovider.hpp"
+
+/**
+ * brief Owner of one NV12 frame taken from an ImgProvider.
+ *
+ * Exposes the frame as OpenCV matrices pointing into the VDO buffer, using
+ * the stride of the stream, so nothing is copied. The buffer is handed back to
+ * the provider when the handle is released or destroyed, after which the views
+ * are empty and can no longer reach the buffer. Handles can be moved but not
+ * copied, so every frame has exactly one owner.
+ */
+class FrameHandle
+{
+  public:
+    FrameHandle();
+    FrameHandle(ImgProvider &provider, VdoBuffer *buffer);
+    FrameHandle(FrameHandle &&other);
+    FrameHandle &operator=(FrameHandle &&other);
+    ~FrameHandle();
+    static FrameHandle Acquire(ImgProvider &provider);
+    bool Valid() const;
+    const cv::Mat &Nv12() const;
+    const cv::Mat &Y() const;
+    const cv::Mat &UV() const;
+    void Release();
+
+  private:
+    FrameHandle(const FrameHandle &);
+    FrameHandle &operator=(const FrameHandle &);
+    ImgProvider *provider;
+    VdoBuffer *buffer;
+    /// Y plane followed by the UV plane, as read by the color areas
+    cv::Mat nv12;
+    /// Luma plane, one byte per pixel
+    cv::Mat y;
+    /// Interleaved chroma plane, one UV pair per 2x2 pixels
+    cv::Mat uv;
+};
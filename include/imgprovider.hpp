@@ -21,9 +21,10 @@
 #pragma once
 
 #include <atomic>
-#include <pthread.h>
+#include <semaphore.h>
 #include <stdbool.h>
 
+#include "spscring.hpp"
 #include "vdo-stream.h"
 #include "vdo-types.h"
 
@@ -35,48 +36,67 @@
  *
  * Keep track of what kind of images the user wants, all the necessary
  * VDO types to setup and maintain a stream, as well as parameters to make
- * the streaming thread safe.
+ * the streaming thread safe. There is one provider per VDO channel analyzed,
+ * and the FrameFetcher fetches the frames of all of them.
  */
 class ImgProvider
 {
   public:
-    ImgProvider(const unsigned int w, const unsigned int h, const unsigned int numFrames, const VdoFormat format);
+    ImgProvider(
+        const unsigned int channel,
+        const unsigned int w,
+        const unsigned int h,
+        const double framerate,
+        const VdoFormat format);
     ~ImgProvider();
     bool InitImgProvider();
     static bool ChooseStreamResolution(
+        const unsigned int channel,
         const unsigned int reqWidth,
         const unsigned int reqHeight,
         unsigned int &chosenWidth,
-        unsigned int &chosenHeight);
+        unsigned int &chosenHeight,
+        const unsigned int aspectWidth = 0,
+        const unsigned int aspectHeight = 0);
     static bool CreateStream(ImgProvider &provider);
     static bool AllocateVdoBuffers(ImgProvider &provider, VdoStream &vdoStream);
     static void ReleaseVdoBuffers(ImgProvider &provider);
     static VdoBuffer *GetLastFrameBlocking(ImgProvider &provider);
     static void ReturnFrame(ImgProvider &provider, VdoBuffer &buffer);
-    static void *threadEntry(void *data);
     static bool StartFrameFetch(ImgProvider &provider);
     static bool StopFrameFetch(ImgProvider &provider);
+    static bool SetFramerate(ImgProvider &provider, const double framerate);
+    unsigned int Width() const;
+    unsigned int Height() const;
+    unsigned int Pitch() const;
+    unsigned int Channel() const;
+    int Fd() const;
 
-    /// Keeping track of frames' statuses.
-    GQueue *delivered_frames;
-    GQueue *processed_frames;
+    /// The most recent frame from VDO not yet taken by the client.
+    std::atomic<VdoBuffer *> latest_frame;
+    /// Frames the client has handed back, to be enqueued to VDO.
+    SpscRing<VdoBuffer *, NUM_VDO_BUFFERS> processed_frames;
 
     /// To support fetching frames asynchonously with VDO.
-    pthread_mutex_t frame_mutex;
-    pthread_cond_t frame_deliver_cond;
-    pthread_t fetcher_thread;
+    sem_t frame_ready;
     std::atomic_bool shutdown;
 
   private:
-    void RunLoopIteration();
+    friend class FrameFetcher;
+    void FetchFrame();
+    void EnqueueBuffer(VdoBuffer *buffer);
     bool initialized;
+    unsigned int channel;
     unsigned int width;
     unsigned int height;
-    /// Number of frames to keep in the delivered_frames queue.
-    unsigned int num_app_frames;
+    /// Bytes between the starts of two rows of a frame
+    unsigned int pitch;
+    double framerate;
     // Stream configuration parameters.
     VdoFormat vdo_format;
     // Vdo stream and buffers handling.
     VdoStream *vdo_stream;
+    /// File descriptor of the non-blocking stream, readable when a frame is ready
+    int vdo_fd;
     VdoBuffer *vdo_buffers[NUM_VDO_BUFFERS];
 };
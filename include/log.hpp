@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+/// Messages the log ring holds before new ones are dropped, a power of two
+#define LOG_RING_SLOTS (256)
+/// Longest message in the log ring, including the terminating null
+#define LOG_MESSAGE_SIZE (256)
+/// Shortest time in ms between two messages from a rate limited call site
+#define LOG_LIMIT_MS (1000)
+
+/**
+ * brief Logging backend of the LOG_* macros.
+ *
+ * While started, a message is formatted into a lock-free ring and written to
+ * syslog and stdout by a background thread, so the calling thread never waits
+ * for the I/O. Any thread may log. If the ring is full the message is dropped
+ * and counted. Before Start() and after Stop() messages are written directly.
+ */
+class Log
+{
+  public:
+    static bool Start();
+    static void Stop();
+    static void Write(const int priority, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  private:
+    static void *threadEntry(void *data);
+};
+
+/**
+ * brief Lets the messages of one call site through at most once per
+ * LOG_LIMIT_MS, counting the ones held back in between.
+ */
+class LogRateLimit
+{
+  public:
+    /**
+     * brief Check whether a message may be logged now.
+     *
+     * param suppressed Set to the number of messages held back since the
+     *        last one that was let through.
+     * return true if the message is to be logged.
+     */
+    bool Allow(unsigned &suppressed)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        const int64_t now = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        int64_t next = nextallowed.load(std::memory_order_relaxed);
+        if (now < next || !nextallowed.compare_exchange_strong(next, now + LOG_LIMIT_MS, std::memory_order_relaxed))
+        {
+            held.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = held.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+  private:
+    std::atomic<int64_t> nextallowed{0};
+    std::atomic<unsigned> held{0};
+};
@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Number of buckets in a latency histogram, covering up to about 30 s
+#define METRIC_BUCKETS (96)
+
+/// Stages of the frame processing that are timed
+enum MetricStage
+{
+    StageCapture = 0,
+    StageWait,
+    StageSetup,
+    StageAveraging,
+    StageOpcUaWrite,
+    StageEventSend,
+    StageShadow,
+    StageCount
+};
+
+/**
+ * brief Fixed size histogram of durations in microseconds.
+ *
+ * Bucket widths grow with the duration, four buckets per power of two, so the
+ * relative error of a percentile is at most 25%. Recording is lock-free and
+ * can be done from any thread.
+ */
+class LatencyHistogram
+{
+  public:
+    LatencyHistogram();
+    void Record(const uint64_t duration_us);
+    uint64_t Count() const;
+    uint64_t Max() const;
+    uint64_t Percentile(const double percentile) const;
+
+  private:
+    static size_t BucketIndex(const uint64_t duration_us);
+    static uint64_t BucketUpperBound(const size_t index);
+    std::atomic<uint32_t> buckets[METRIC_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> max;
+};
+
+/**
+ * brief Latency histograms of the frame processing stages.
+ */
+class Metrics
+{
+  public:
+    static void Record(const MetricStage stage, const int64_t start_us, const int64_t end_us);
+    static const LatencyHistogram &Histogram(const MetricStage stage);
+    static const char *StageName(const MetricStage stage);
+    static int64_t Now();
+};
@@ -18,8 +18,49 @@
 
 #include <open62541/server.h>
 #include <open62541/server_config_default.h>
+#include <atomic>
 #include <thread>
 
+#include "analysisresult.hpp"
+#include "metrics.hpp"
+
+/**
+ * The server publishes the analysis results from its own thread; the analysis
+ * threads queue every result, one at a time, and a repeated server callback writes them to
+ * the address space in order. Publishing thereby overlaps with the evaluation
+ * of the next frames, and no state change is lost when several results come
+ * between two callbacks.
+ *
+ * A color area value is only written when it changes, with the evaluation
+ * time as source timestamp. Freshness is instead shown by the LastEvaluated
+ * node, which is refreshed at most once per heartbeat interval.
+ *
+ * Besides the ColorAreaReading booleans, each color area is exposed as an
+ * object of type ColorAreaType with the measured color, the difference from
+ * the target color, the frame counter and the evaluation latency. These are
+ * also only written when they change, the colors by at least a deadband, and
+ * the frame counter and latency along with them or with the heartbeat. All
+ * nodes of a frame are written in the same server callback, so a client never
+ * sees values from different frames mixed.
+ *
+ * The Diagnostics object holds the p50/p99 latencies of the processing stages,
+ * updated once per second.
+ */
+/// Variables of a ColorAreaType object
+enum ColorAreaVariable
+{
+    AreaWithinTolerance = 0,
+    AreaMeasuredRed,
+    AreaMeasuredGreen,
+    AreaMeasuredBlue,
+    AreaDifferenceRed,
+    AreaDifferenceGreen,
+    AreaDifferenceBlue,
+    AreaFrame,
+    AreaLatency,
+    AreaVariableCount
+};
+
 class OpcUaServer
 {
   public:
@@ -28,14 +69,61 @@ class OpcUaServer
     bool LaunchServer(const unsigned int port);
     void ShutDownServer();
     bool IsRunning() const;
-    void UpdateColorAreaValue(bool value);
-    bool GetColorAreaValue(void);
+    void SetHeartbeatInterval(const uint32_t interval_ms);
+    bool Publish(const AnalysisResult &result);
 
   protected:
   private:
-    void AddBoolean(char *label, UA_Boolean value);
+    bool AddVariable(
+        const UA_NodeId &id,
+        const UA_NodeId &parent,
+        const UA_NodeId &reference,
+        char *label,
+        void *value,
+        const UA_DataType &type);
+    void AddColorAreaType();
+    void AddDiagnostics();
+    void AddColorArea(const size_t index);
+    void RemoveColorArea(const size_t index);
+    void SetNumColorAreas(const size_t count);
+    void UpdateColorAreaValue(const size_t index, bool value, const UA_DateTime timestamp);
+    void UpdateColorAreaReading(const size_t index, const UA_DateTime timestamp, const bool refresh);
+    bool WriteReading(
+        const UA_NodeId &id,
+        double value,
+        double &published,
+        const bool force,
+        const UA_DateTime timestamp);
+    bool UpdateHeartbeat(const UA_DateTime timestamp);
+    void WriteValue(const UA_NodeId &id, void *value, const UA_DataType &type, const UA_DateTime timestamp);
+    void ClearNodeIds();
+    static void GetColorAreaLabel(const size_t index, char *label, const size_t size);
+    static void GetColorAreaObjectLabel(const size_t index, char *label, const size_t size);
+    static void PublishResults(UA_Server *server, void *data);
+    static void PublishDiagnostics(UA_Server *server, void *data);
     static void RunUaServer(OpcUaServer *parent);
-    bool colorareavalue;
+    void PublishResult();
+    /// Results not yet written, filled by Publish()
+    AnalysisQueue queue;
+    /// Whether a server thread consumes the queue
+    std::atomic<bool> accepting;
+    AnalysisResult result;
+    size_t numcolorareas;
+    /// Resolved node ids, so they are not built from labels per write
+    UA_NodeId nodeids[MAX_REGIONS];
+    UA_NodeId objectids[MAX_REGIONS];
+    UA_NodeId variableids[MAX_REGIONS][AreaVariableCount];
+    UA_NodeId heartbeatnodeid;
+    /// p50 and p99 latency node ids per processing stage
+    UA_NodeId diagnosticids[StageCount][2];
+    /// Last value written per color area
+    bool publishedvalues[MAX_REGIONS];
+    bool valuepublished[MAX_REGIONS];
+    /// Last measurements written per color area
+    ColorAreaReading publishedreadings[MAX_REGIONS];
+    bool readingpublished[MAX_REGIONS];
+    std::atomic<uint32_t> heartbeatinterval;
+    UA_DateTime lastheartbeat;
     std::thread *serverthread;
     UA_Boolean running;
     UA_Server *server;
@@ -0,0 +1,147 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/core/types.hpp>
+#include <string>
+#include <vector>
+
+#include "colorarea.hpp"
+#include "taskpool.hpp"
+
+#define MAX_REGIONS (64)
+/// Highest VDO channel a color area can be on, channels start at 1
+#define MAX_CHANNELS (8)
+/// Channel of color areas that do not give one
+#define DEFAULT_CHANNEL (1)
+/// Number of frame rows evaluated together in one sweep over the regions
+#define REGION_BAND_ROWS (16)
+/// Pixels of color areas to evaluate in one task when evaluating in parallel
+#define REGION_TASK_PIXELS (32768)
+/// Building the summed-area table costs about this many times summing a pixel,
+/// as measured with colorbench -S rows,table
+#define SAT_COST_FACTOR (2)
+/// Largest summed-area table in pixels, 12 bytes each
+#define SAT_MAX_PIXELS (1 << 19)
+
+/// Configuration of one color area in a region set
+struct RegionSpec
+{
+    cv::Point center;
+    cv::Scalar color;
+    uint32_t markerwidth;
+    uint32_t markerheight;
+    uint8_t markershape;
+    uint8_t tolerance;
+    /// VDO channel showing the color area
+    uint8_t channel;
+};
+
+/// How a region set evaluates its rectangles
+enum EvaluationStrategy
+{
+    /// Summed-area table if it is cheaper than summing the rectangles
+    StrategyAuto = 0,
+    /// Sum the pixels of every color area row by row
+    StrategyRows,
+    /// Look the rectangles up in a summed-area table
+    StrategySummedArea,
+    StrategyCount
+};
+
+/// Result of evaluating one color area
+struct RegionResult
+{
+    cv::Scalar average;
+    bool withintolerance;
+};
+
+/**
+ * brief A set of color areas evaluated together in one pass over the frame.
+ *
+ * The frame is split into bands of REGION_BAND_ROWS rows. For each band the
+ * regions that intersect it are known beforehand, so every row of the Y and UV
+ * planes is read once for all regions covering it instead of once per region.
+ *
+ * For parallel evaluation, consecutive bands are grouped into tasks of about
+ * REGION_TASK_PIXELS pixels of color areas. A large region is thereby split
+ * into tiles of rows, while many small regions are grouped into one task.
+ * Each task sums into sums of its own, which are added up once all tasks are
+ * done, so the tasks share nothing and need no locks.
+ *
+ * Many or large overlapping rectangles can instead be looked up in a
+ * summed-area table of Y, U and V over the bounding box of all rectangles,
+ * which costs one pass over the box and then four lookups per rectangle. The
+ * table is built in tiles of rows by tasks of their own. Each tile holds the
+ * sums from its first row, and the sums of the rows above the tile are added
+ * at lookup from one offset row per tile. StrategyAuto uses the table when
+ * the rectangles cover more than SAT_COST_FACTOR times the pixels of the box.
+ */
+class RegionSet
+{
+  public:
+    RegionSet(const cv::Size &img_size, const std::vector<RegionSpec> &specs);
+    ~RegionSet();
+    size_t Size() const;
+    const ColorArea &Region(const size_t index) const;
+    void SetTarget(const size_t index, const cv::Scalar &color, const uint8_t tolerance);
+    void SetMetric(const ColorMetricType type);
+    void Evaluate(const cv::Mat &nv12_img, std::vector<RegionResult> &results, TaskPool *pool = nullptr);
+    void SetStrategy(const EvaluationStrategy strategy);
+    bool UsesSummedArea() const;
+    static ColorArea *CreateColorArea(const cv::Size &img_size, const RegionSpec &spec);
+    static bool ParseRegions(const std::string &str, const cv::Size &bounds, std::vector<RegionSpec> &specs);
+
+  private:
+    /// Consecutive bands evaluated by one task
+    struct BandTask
+    {
+        size_t firstband;
+        size_t endband;
+        /// Indices of the regions intersecting the bands
+        std::vector<size_t> regions;
+    };
+    RegionSet(const RegionSet &);
+    RegionSet &operator=(const RegionSet &);
+    void PlanTasks();
+    void EvaluateTask(const cv::Mat &nv12_img, const size_t task);
+    void BuildTableTile(const cv::Mat &nv12_img, const size_t tile);
+    void TableSums(const size_t row, const size_t column, uint32_t *yuv) const;
+    void LookUpTable(const size_t index, YuvSums &regionsums) const;
+    std::vector<ColorArea *> regions;
+    /// Indices of the regions intersecting each band of the frame
+    std::vector<std::vector<size_t>> bands;
+    std::vector<BandTask> tasks;
+    std::vector<YuvSums> sums;
+    /// Sums of each task, regions.size() per task
+    std::vector<YuvSums> tasksums;
+    cv::Size img_size;
+    std::vector<uint8_t> shapes;
+    EvaluationStrategy strategy;
+    // The summed-area table, empty when the rectangles are summed row by row
+    /// Indices of the regions looked up in the table
+    std::vector<size_t> tableregions;
+    cv::Rect tablebox;
+    size_t tilerows;
+    size_t tiles;
+    /// Y, U and V sums of the box pixels above and left of each entry, from
+    /// the first row of the tile, box height + 1 rows of box width + 1 entries
+    std::vector<uint32_t> table;
+    /// Y, U and V sums of the box rows above each tile, box width + 1 per tile
+    std::vector<uint32_t> tileoffsets;
+};
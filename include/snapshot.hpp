@@ -0,0 +1,78 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <type_traits>
+
+/**
+ * brief A value published by one writer thread and read by any number of
+ * reader threads without locks (a sequence lock).
+ *
+ * The writer never waits. A reader retries its copy if the writer published a
+ * new value meanwhile, so T must be trivially copyable and small enough to be
+ * copied many times per publish interval.
+ */
+template <typename T>
+class Snapshot
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshot values must be trivially copyable");
+
+  public:
+    Snapshot() : sequence(0), value()
+    {
+    }
+
+    /// Publish a new value; must only be called from one thread
+    void Publish(const T &newvalue)
+    {
+        const uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        value = newvalue;
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    /// Copy the latest value and return how many values have been published
+    uint32_t Read(T &copy) const
+    {
+        uint32_t before;
+        uint32_t after;
+        do
+        {
+            before = sequence.load(std::memory_order_acquire);
+            copy = value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while (before != after || (before & 1));
+
+        return before / 2;
+    }
+
+    /// Number of values published so far
+    uint32_t Version() const
+    {
+        return sequence.load(std::memory_order_acquire) / 2;
+    }
+
+  private:
+    Snapshot(const Snapshot &);
+    Snapshot &operator=(const Snapshot &);
+    std::atomic<uint32_t> sequence;
+    T value;
+};
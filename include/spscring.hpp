@@ -0,0 +1,78 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+#define SPSC_CACHE_LINE (64)
+
+/**
+ * brief Fixed capacity lock-free single producer/single consumer ring.
+ *
+ * Push() must only be called from one thread and Pop() from one (other)
+ * thread. No memory is allocated after construction.
+ */
+template <typename T, size_t N>
+class SpscRing
+{
+  public:
+    SpscRing() : head(0), tail(0)
+    {
+    }
+
+    /// Add an item; returns false if the ring is full
+    bool Push(const T &item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= N)
+        {
+            return false;
+        }
+        items[t % N] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Remove the oldest item; returns false if the ring is empty
+    bool Pop(T &item)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == h)
+        {
+            return false;
+        }
+        item = items[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Number of items, exact only when called from the producer or consumer
+    size_t Size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+  private:
+    SpscRing(const SpscRing &);
+    SpscRing &operator=(const SpscRing &);
+    // Keep the indices on separate cache lines to avoid false sharing, which
+    // also holds for rings on the heap since C++17 new honors over-alignment
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> head;
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail;
+    alignas(SPSC_CACHE_LINE) T items[N];
+};
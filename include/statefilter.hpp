@@ -0,0 +1,60 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <opencv2/core/types.hpp>
+#include <stdint.h>
+
+/// Settings of the temporal filtering of a color area
+struct FilterConfig
+{
+    /// Number of frames the exponential moving average spans, 1 disables it
+    uint32_t smoothingframes;
+    /// Extra deviation allowed before a color area leaves the within state
+    uint32_t hysteresis;
+    /// Time a new state has to persist before it is reported
+    uint32_t mindwell_ms;
+};
+
+/**
+ * brief Temporal filter turning per frame averages into a stable state.
+ *
+ * The average color is smoothed with an exponential moving average. The
+ * within tolerance state is entered when the deviation of the smoothed color
+ * is below the tolerance and left only when it reaches tolerance plus the
+ * hysteresis. A changed state is reported once it has persisted for the
+ * minimum dwell time. All updates are O(1) per frame.
+ */
+class StateFilter
+{
+  public:
+    StateFilter();
+    void Configure(const FilterConfig &config);
+    void Reset();
+    const cv::Scalar &Smooth(const cv::Scalar &average);
+    bool Update(const double deviation, const double tolerance, const int64_t now_us);
+
+  private:
+    cv::Scalar smoothed;
+    double alpha;
+    double hysteresis;
+    int64_t mindwell_us;
+    /// Start of the current candidate state, 0 when it equals the state
+    int64_t candidatesince;
+    bool primed;
+    bool state;
+};
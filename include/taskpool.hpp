@@ -0,0 +1,97 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+/// Largest number of threads running the tasks of one Run(), the caller included
+#define MAX_POOL_THREADS (16)
+#define POOL_CACHE_LINE (64)
+
+/**
+ * brief A fixed pool of threads running the tasks of a parallel loop.
+ *
+ * Run() splits the task indices into one contiguous range per taking part
+ * thread, the calling thread included. A thread takes tasks from the front of
+ * its own range and, once that is empty, steals from the ranges of the
+ * others, so uneven tasks even out without a central queue. Taking a task is
+ * one atomic increment, and running tasks allocates no memory.
+ *
+ * Only one Run() uses the pool at a time. A Run() called while the pool is
+ * busy, e.g. by the analysis of another channel, runs its tasks on the
+ * calling thread instead of waiting.
+ */
+class TaskPool
+{
+  public:
+    explicit TaskPool(const size_t numworkers);
+    ~TaskPool();
+    void SetMaxThreads(const size_t maxthreads);
+    size_t MaxThreads() const;
+    static size_t DefaultWorkers();
+
+    /**
+     * brief Run function(task) for every task in 0 to count - 1 and wait for
+     * all of them to finish.
+     *
+     * Everything the tasks write is visible to the caller when Run() returns.
+     */
+    template <typename F> void Run(const size_t count, F &function)
+    {
+        RunTasks(count, Call<F>, &function);
+    }
+
+  private:
+    typedef void (*TaskFunction)(void *function, const size_t task);
+    template <typename F> static void Call(void *function, const size_t task)
+    {
+        (*static_cast<F *>(function))(task);
+    }
+    /// Tasks not yet taken from one thread's range. Aligned to a cache line of
+    /// its own, so threads taking tasks from different ranges do not contend.
+    struct alignas(POOL_CACHE_LINE) TaskRange
+    {
+        std::atomic<size_t> next;
+        size_t end;
+    };
+    TaskPool(const TaskPool &);
+    TaskPool &operator=(const TaskPool &);
+    void RunTasks(const size_t count, TaskFunction call, void *function);
+    void TakeTasks(const size_t self);
+    void WorkerEntry(const size_t self);
+
+    std::vector<std::thread> workers;
+    std::atomic<size_t> maxthreads;
+    /// Held for the whole of a Run() using the workers
+    std::mutex runmtx;
+    // The current Run(), set up under wakemtx before the workers are woken
+    std::mutex wakemtx;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation;
+    size_t participants;
+    size_t pending;
+    bool stopping;
+    TaskFunction call;
+    void *function;
+    TaskRange ranges[MAX_POOL_THREADS];
+};
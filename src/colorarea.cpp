@@ -21,6 +21,7 @@
 #include <opencv2/imgproc.hpp>
 
 #include "colorarea.hpp"
+#include "colorkernels.hpp"
 #include "common.hpp"
 
 using namespace cv;
@@ -34,27 +35,43 @@ using namespace std;
 #define DBG_WRITE_IMG(filename, img)
 #endif
 
+// Convert a YUV triplet to BGR using the same BT.601 limited range
+// coefficients as OpenCV uses for COLOR_YUV2BGR_NV12.
+static Scalar yuv_to_bgr(const double y, const double u, const double v)
+{
+    const double luma = 1.164 * max(0.0, y - 16.0);
+    const double cb = u - 128.0;
+    const double cr = v - 128.0;
+    const double b = luma + 2.018 * cb;
+    const double g = luma - 0.813 * cr - 0.391 * cb;
+    const double r = luma + 1.596 * cr;
+
+    return Scalar(min(255.0, max(0.0, b)), min(255.0, max(0.0, g)), min(255.0, max(0.0, r)));
+}
+
 ColorArea::ColorArea(
-    const Mat &img,
+    const MarkerShape shape,
+    const Size &img_size,
     const Point &point_center,
     const Scalar &color,
     const uint32_t markerwidth,
     const uint32_t markerheight,
     const uint8_t tolerance)
-    : color(color), img_size(img.size()), markerwidth(markerwidth), markerheight(markerheight), tolerance(tolerance)
+    : color(color), shape(shape), format(FormatNV12), kernel(&ResolveKernel(shape, FormatNV12, MetricChannel)),
+      img_size(img_size), markerwidth(markerwidth), markerheight(markerheight), tolerance(tolerance)
 {
     // Crop to avoid processing pixels outside color area
     int max_x = point_center.x + markerwidth / 2;
     int max_y = point_center.y + markerheight / 2;
     int min_x = point_center.x - markerwidth / 2;
     int min_y = point_center.y - markerheight / 2;
-    if (img.size().width < max_x)
+    if (img_size.width < max_x)
     {
-        max_x = img.size().width;
+        max_x = img_size.width;
     }
-    if (img.size().height < max_y)
+    if (img_size.height < max_y)
     {
-        max_y = img.size().height;
+        max_y = img_size.height;
     }
     if (0 > min_x)
     {
@@ -68,10 +85,6 @@ ColorArea::ColorArea(
     croprange_y = Range(min_y, max_y);
     const Point offset(croprange_x.start, croprange_y.start);
     this->point_center = point_center - offset;
-#if defined(DEBUG_WRITE)
-    Mat cropped_img = img(croprange_y, croprange_x);
-    DBG_WRITE_IMG("cropped_img.jpg", cropped_img);
-#endif
 
     LOG_I(
         "%s/%s: img size = %ux%u, marker size = %ux%u, center = (%u, %u), color (R, G, B) = (%.1f, %.1f, %.1f), "
@@ -95,24 +108,215 @@ ColorArea::~ColorArea()
 {
 }
 
-Scalar ColorArea::GetAverageColor(const Mat &img) const
+/**
+ * brief Draw the outline of the color area.
+ *
+ * A covered pixel is part of the outline if it is the first or last one of its
+ * row's span, or if the pixel above or below it is not covered.
+ *
+ * param bgr_img Image with the size the color area was set up for.
+ */
+void ColorArea::DrawMarker(Mat &bgr_img) const
 {
-    // Make sure input image has the same size as the gague was set up for
-    assert(img_size == img.size());
+    assert(img_size == bgr_img.size());
+    assert(CV_8UC3 == bgr_img.type());
+
+    const Vec3b white(255, 255, 255);
+    const Vec3b black(0, 0, 0);
+    for (size_t i = 0; i < rowspans.size(); i++)
+    {
+        const Range &span = rowspans[i];
+        if (span.empty())
+        {
+            continue;
+        }
+        // Pixels covered by both neighbouring rows are inside the area
+        Range inner(0, 0);
+        if (0 < i && rowspans.size() > i + 1)
+        {
+            const Range &above = rowspans[i - 1];
+            const Range &below = rowspans[i + 1];
+            inner = Range(
+                max(span.start + 1, max(above.start, below.start)),
+                min(span.end - 1, min(above.end, below.end)));
+        }
+
+        Vec3b *row = bgr_img.ptr<Vec3b>(croprange_y.start + i);
+        for (int col = span.start; col < span.end; col++)
+        {
+            if (col < inner.start || col >= inner.end)
+            {
+                row[col] = white;
+            }
+        }
+        if (0 < span.start)
+        {
+            row[span.start - 1] = black;
+        }
+        if (img_size.width > span.end)
+        {
+            row[span.end] = black;
+        }
+    }
+}
+
+#if defined(DEBUG_WRITE)
+void ColorArea::WriteDebugImages(const Mat &bgr_img) const
+{
+    assert(img_size == bgr_img.size());
+
+    Mat cropped_img = bgr_img(croprange_y, croprange_x);
+    DBG_WRITE_IMG("cropped_img.jpg", cropped_img);
+
+    // Create a debug image to show the marker
+    auto marker_img = bgr_img.clone();
+    DrawMarker(marker_img);
+    DBG_WRITE_IMG("marker_img.jpg", marker_img);
+
+    // Render the spans as a mask
+    Mat mask_img = Mat::zeros(Size(croprange_x.size(), croprange_y.size()), CV_8U);
+    for (size_t i = 0; i < rowspans.size(); i++)
+    {
+        for (int col = rowspans[i].start; col < rowspans[i].end; col++)
+        {
+            mask_img.at<uint8_t>(i, col - croprange_x.start) = 255;
+        }
+    }
+    DBG_WRITE_IMG("mask_img.jpg", mask_img);
+}
+#endif
+
+cv::Range ColorArea::GetRowRange() const
+{
+    return croprange_y;
+}
+
+cv::Range ColorArea::GetColumnRange() const
+{
+    return croprange_x;
+}
+
+const cv::Scalar &ColorArea::GetColor() const
+{
+    return color;
+}
+
+uint8_t ColorArea::GetTolerance() const
+{
+    return tolerance;
+}
+
+/**
+ * brief Change the target color and tolerance, keeping the shape.
+ *
+ * param color New target color.
+ * param tolerance New tolerance.
+ */
+void ColorArea::SetTarget(const cv::Scalar &color, const uint8_t tolerance)
+{
+    this->color = color;
+    this->tolerance = tolerance;
+}
+
+/**
+ * brief Change how the distance to the target color is measured.
+ *
+ * param type The metric, compared against the tolerance.
+ */
+void ColorArea::SetMetric(const ColorMetricType type)
+{
+    kernel = &ResolveKernel(shape, format, type);
+}
 
-    // Crop
-    auto crop_img = img(croprange_y, croprange_x);
-    DBG_WRITE_IMG("avg_after_crop.jpg", crop_img);
+/**
+ * brief Add the samples of a color area in a range of frame rows.
+ *
+ * The rows are clipped to the crop. A rectangle covers the whole crop on every
+ * row, so only an ellipse looks up its spans.
+ */
+template <MarkerShape Shape, PixelFormat Format>
+void ColorArea::SumRowsOf(const ColorArea &area, const Mat &img, const int firstrow, const int endrow, YuvSums &sums)
+{
+    static_assert(FormatNV12 == Format, "unknown pixel format");
+    const int first = max(firstrow, area.croprange_y.start);
+    const int end = min(endrow, area.croprange_y.end);
+    for (int row = first; row < end; row++)
+    {
+        Range span = area.croprange_x;
+        if constexpr (Ellipse == Shape)
+        {
+            span = area.rowspans[row - area.croprange_y.start];
+        }
 
-    return mean(crop_img, colorarea_mask);
+        // The interleaved UV plane starts after img_size.height rows of luma
+        // and has one UV pair per 2x2 luma pixels.
+        const uint8_t *y_row = img.ptr<uint8_t>(row);
+        const uint8_t *uv_row = img.ptr<uint8_t>(area.img_size.height + row / 2);
+        SumRowNV12(y_row, uv_row, span.start, span.end, sums);
+    }
 }
 
-bool ColorArea::ColorAreaValueWithinTolerance(const Mat &img) const
+/**
+ * brief Get the kernel for a combination of shape, pixel format and metric.
+ *
+ * The kernels are instantiated for every combination at compile time, so this
+ * is a table lookup.
+ */
+const RegionKernel &
+ColorArea::ResolveKernel(const MarkerShape shape, const PixelFormat format, const ColorMetricType metric)
+{
+#define REGION_KERNEL(shape, format, metric) {&SumRowsOf<shape, format>, &MetricDistance<metric>}
+    static const RegionKernel kernels[MarkerCount][FormatCount][MetricTypeCount] = {
+        {{REGION_KERNEL(Ellipse, FormatNV12, MetricChannel),
+          REGION_KERNEL(Ellipse, FormatNV12, MetricDeltaE76),
+          REGION_KERNEL(Ellipse, FormatNV12, MetricDeltaE2000),
+          REGION_KERNEL(Ellipse, FormatNV12, MetricHue)}},
+        {{REGION_KERNEL(Rectangle, FormatNV12, MetricChannel),
+          REGION_KERNEL(Rectangle, FormatNV12, MetricDeltaE76),
+          REGION_KERNEL(Rectangle, FormatNV12, MetricDeltaE2000),
+          REGION_KERNEL(Rectangle, FormatNV12, MetricHue)}}};
+#undef REGION_KERNEL
+    static_assert(2 == MarkerCount && 1 == FormatCount && 4 == MetricTypeCount, "kernel table is incomplete");
+
+    assert(MarkerCount > shape && FormatCount > format && MetricTypeCount > metric);
+    return kernels[shape][format][metric];
+}
+
+Scalar ColorArea::AverageColor(const YuvSums &sums)
+{
+    if (0 == sums.count)
+    {
+        return Scalar();
+    }
+
+    // The YUV to BGR conversion is affine (apart from clamping), so converting
+    // the mean YUV value gives the mean BGR value of the colorarea.
+    return yuv_to_bgr(
+        static_cast<double>(sums.y) / sums.count,
+        static_cast<double>(sums.u) / sums.count,
+        static_cast<double>(sums.v) / sums.count);
+}
+
+Scalar ColorArea::GetAverageColor(const Mat &nv12_img) const
 {
     // Make sure input image has the same size as the gague was set up for
-    assert(img_size == img.size());
+    assert(img_size.width == nv12_img.cols);
+    assert(img_size.height * 3 / 2 == nv12_img.rows);
+
+    // Only visit the samples within the crop
+    YuvSums sums = {0, 0, 0, 0};
+    SumRows(nv12_img, croprange_y.start, croprange_y.end, sums);
 
-    auto currentavg = GetAverageColor(img);
+    return AverageColor(sums);
+}
+
+bool ColorArea::ColorAreaValueWithinTolerance(const Mat &nv12_img) const
+{
+    return WithinTolerance(GetAverageColor(nv12_img));
+}
+
+bool ColorArea::WithinTolerance(const Scalar &currentavg) const
+{
     LOG_D(
         "%s/%s: Target/Current average color in region: (%1.f, %.1f, %.1f)/(%.1f, %.1f, %.1f)",
         __FILE__,
@@ -123,75 +327,74 @@ bool ColorArea::ColorAreaValueWithinTolerance(const Mat &img) const
         currentavg.val[R],
         currentavg.val[G],
         currentavg.val[B]);
-    auto colordiff_r = abs(color.val[R] - currentavg.val[R]);
-    auto colordiff_g = abs(color.val[G] - currentavg.val[G]);
-    auto colordiff_b = abs(color.val[B] - currentavg.val[B]);
 
-    return (tolerance > colordiff_r && tolerance > colordiff_g && tolerance > colordiff_b);
+    return tolerance > Deviation(currentavg);
+}
+
+/**
+ * brief Get the distance of an average color from the target.
+ *
+ * param currentavg Average color of the color area.
+ * return The deviation in the unit of the metric, compared against the
+ *        tolerance.
+ */
+double ColorArea::Deviation(const Scalar &currentavg) const
+{
+    return kernel->distance(color, currentavg);
 }
 
 ColorAreaEllipse::ColorAreaEllipse(
-    const Mat &img,
+    const Size &img_size,
     const Point &point_center,
     const Scalar &color,
     const uint32_t markerwidth,
     const uint32_t markerheight,
     const uint8_t tolerance)
-    : ColorArea(img, point_center, color, markerwidth, markerheight, tolerance)
+    : ColorArea(Ellipse, img_size, point_center, color, markerwidth, markerheight, tolerance)
 {
-#if defined(DEBUG_WRITE)
-    // Create a debug image tho show the marker
-    auto marker_img = img.clone();
-
-    // Draw the ellipse
-    Size axes(markerwidth / 2, markerheight / 2);
-    ellipse(marker_img, point_center, axes, 0, 0, 360, cv::Scalar(0, 0, 0), 3);
-    ellipse(marker_img, point_center, axes, 0, 0, 360, cv::Scalar(255, 255, 255), 1);
-
-    DBG_WRITE_IMG("marker_img.jpg", marker_img);
-#endif
+    // Compute the span of each row from the ellipse equation
+    // (x - cx)^2 / a^2 + (y - cy)^2 / b^2 <= 1, clipped to the crop
+    const double a = markerwidth / 2;
+    const double b = markerheight / 2;
+    rowspans.resize(croprange_y.size());
+    for (int row = croprange_y.start; row < croprange_y.end; row++)
+    {
+        const double dy = row - point_center.y;
+        double halfwidth = -1.0;
+        if (0.0 == b)
+        {
+            halfwidth = (0.0 == dy) ? a : -1.0;
+        }
+        else if (b >= abs(dy))
+        {
+            halfwidth = a * sqrt(1.0 - (dy * dy) / (b * b));
+        }
 
-    // Create color mask
-    colorarea_mask = Mat::zeros(Size(croprange_x.size(), croprange_y.size()), CV_8U);
-    ellipse(
-        colorarea_mask,
-        this->point_center,
-        Size(markerwidth / 2, markerheight / 2),
-        0.0,
-        0,
-        360,
-        Scalar(255, 255, 255),
-        -1,
-        LINE_8,
-        0);
-    DBG_WRITE_IMG("mask_img.jpg", colorarea_mask);
+        Range span(croprange_x.start, croprange_x.start);
+        if (0.0 <= halfwidth)
+        {
+            const int start = max(croprange_x.start, static_cast<int>(ceil(point_center.x - halfwidth - 1e-9)));
+            const int end = min(croprange_x.end, static_cast<int>(floor(point_center.x + halfwidth + 1e-9)) + 1);
+            if (start < end)
+            {
+                span = Range(start, end);
+            }
+        }
+        rowspans[row - croprange_y.start] = span;
+    }
     LOG_I("%s/%s: Elliptic colorarea created", __FILE__, __FUNCTION__);
 }
 
 ColorAreaRectangle::ColorAreaRectangle(
-    const Mat &img,
+    const Size &img_size,
     const Point &point_center,
     const Scalar &color,
     const uint32_t markerwidth,
     const uint32_t markerheight,
     const uint8_t tolerance)
-    : ColorArea(img, point_center, color, markerwidth, markerheight, tolerance)
+    : ColorArea(Rectangle, img_size, point_center, color, markerwidth, markerheight, tolerance)
 {
-#if defined(DEBUG_WRITE)
-    // Create a debug image tho show the marker
-    auto marker_img = img.clone();
-
-    // Draw the rectangle
-    auto pt1 = point_center - Point(markerwidth / 2, markerheight / 2);
-    auto pt2 = point_center + Point(markerwidth / 2, markerheight / 2);
-    rectangle(marker_img, pt1, pt2, Scalar(0, 0, 0), 3);
-    rectangle(marker_img, pt1, pt2, Scalar(255, 255, 255), 1);
-
-    DBG_WRITE_IMG("marker_img.jpg", marker_img);
-#endif
-
-    // Create color mask
-    colorarea_mask = Mat::ones(Size(croprange_x.size(), croprange_y.size()), CV_8U) * 255;
-    DBG_WRITE_IMG("mask_img.jpg", colorarea_mask);
+    // Every row covers the whole crop
+    rowspans.assign(croprange_y.size(), croprange_x);
     LOG_I("%s/%s: Rectancular colorarea created", __FILE__, __FUNCTION__);
 }
@@ -0,0 +1,118 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "colorkernels.hpp"
+
+static uint32_t sum_bytes(const uint8_t *data, const int count)
+{
+    uint32_t sum = 0;
+    int i = 0;
+#if defined(__ARM_NEON)
+    // Pairwise widening adds keep 4 lanes of 32 bit partial sums, which cannot
+    // overflow for any row length a VDO stream can have.
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= count; i += 16)
+    {
+        acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(data + i)));
+    }
+    uint64x2_t acc64 = vpaddlq_u32(acc);
+    sum = vgetq_lane_u64(acc64, 0) + vgetq_lane_u64(acc64, 1);
+#endif
+    for (; i < count; i++)
+    {
+        sum += data[i];
+    }
+
+    return sum;
+}
+
+static void sum_uv_pairs(const uint8_t *uv, const int count, uint32_t &sum_u, uint32_t &sum_v)
+{
+    uint32_t u = 0;
+    uint32_t v = 0;
+    int i = 0;
+#if defined(__ARM_NEON)
+    uint32x4_t acc_u = vdupq_n_u32(0);
+    uint32x4_t acc_v = vdupq_n_u32(0);
+    for (; i + 16 <= count; i += 16)
+    {
+        // De-interleave 16 UV pairs
+        const uint8x16x2_t pairs = vld2q_u8(uv + 2 * i);
+        acc_u = vpadalq_u16(acc_u, vpaddlq_u8(pairs.val[0]));
+        acc_v = vpadalq_u16(acc_v, vpaddlq_u8(pairs.val[1]));
+    }
+    uint64x2_t acc64_u = vpaddlq_u32(acc_u);
+    uint64x2_t acc64_v = vpaddlq_u32(acc_v);
+    u = vgetq_lane_u64(acc64_u, 0) + vgetq_lane_u64(acc64_u, 1);
+    v = vgetq_lane_u64(acc64_v, 0) + vgetq_lane_u64(acc64_v, 1);
+#endif
+    for (; i < count; i++)
+    {
+        u += uv[2 * i];
+        v += uv[2 * i + 1];
+    }
+    sum_u += u;
+    sum_v += v;
+}
+
+/**
+ * brief Add the NV12 samples of luma columns [start, end) of one row.
+ *
+ * Every luma pixel is counted with the UV pair of its 2x2 block, i.e. the
+ * chroma is weighted as if it had been upsampled to full resolution.
+ *
+ * param y_row First sample of the luma row.
+ * param uv_row First sample of the interleaved UV row holding the row's chroma.
+ * param start First luma column.
+ * param end Luma column after the last one.
+ * param sums Sums to add the samples to.
+ */
+void SumRowNV12(const uint8_t *y_row, const uint8_t *uv_row, int start, int end, YuvSums &sums)
+{
+    assert(start <= end);
+    if (start == end)
+    {
+        return;
+    }
+    sums.y += sum_bytes(y_row + start, end - start);
+    sums.count += end - start;
+
+    // Odd edges only cover half of their 2x2 chroma block
+    uint32_t edge_u = 0;
+    uint32_t edge_v = 0;
+    if (start & 1)
+    {
+        edge_u += uv_row[start - 1];
+        edge_v += uv_row[start];
+        start++;
+    }
+    if (end & 1 && start < end)
+    {
+        edge_u += uv_row[end - 1];
+        edge_v += uv_row[end];
+        end--;
+    }
+    uint32_t pair_u = 0;
+    uint32_t pair_v = 0;
+    sum_uv_pairs(uv_row + start, (end - start) / 2, pair_u, pair_v);
+    sums.u += 2 * static_cast<uint64_t>(pair_u) + edge_u;
+    sums.v += 2 * static_cast<uint64_t>(pair_v) + edge_v;
+}
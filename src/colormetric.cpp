@@ -0,0 +1,214 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "colorarea.hpp"
+#include "colormetric.hpp"
+
+using namespace cv;
+using namespace std;
+
+/// Entries of the sRGB linearization table, one per 8 bit value
+#define SRGB_LUT_SIZE (256)
+
+/**
+ * brief Table of the sRGB transfer function, interpolated for mean values.
+ */
+class SrgbLut
+{
+  public:
+    SrgbLut()
+    {
+        for (int i = 0; i < SRGB_LUT_SIZE; i++)
+        {
+            const double c = i / 255.0;
+            table[i] = (0.04045 >= c) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+        }
+        table[SRGB_LUT_SIZE] = table[SRGB_LUT_SIZE - 1];
+    }
+
+    double Linear(const double value) const
+    {
+        const double clamped = min(255.0, max(0.0, value));
+        const int index = static_cast<int>(clamped);
+        const double fraction = clamped - index;
+        return table[index] + fraction * (table[index + 1] - table[index]);
+    }
+
+  private:
+    double table[SRGB_LUT_SIZE + 1];
+};
+
+static const SrgbLut srgblut;
+
+static double lab_f(const double t)
+{
+    // Linear below (6/29)^3 to avoid the infinite slope of the cube root
+    const double delta = 6.0 / 29.0;
+    return (delta * delta * delta < t) ? cbrt(t) : t / (3.0 * delta * delta) + 4.0 / 29.0;
+}
+
+static double degrees(const double radians)
+{
+    return radians * 180.0 / M_PI;
+}
+
+static double radians(const double degrees)
+{
+    return degrees * M_PI / 180.0;
+}
+
+/**
+ * brief Convert an sRGB color to CIELAB with a D65 white point.
+ *
+ * param bgr Color with channels in the range 0-255.
+ * return L, a and b.
+ */
+static Scalar bgr_to_lab(const Scalar &bgr)
+{
+    const double r = srgblut.Linear(bgr.val[R]);
+    const double g = srgblut.Linear(bgr.val[G]);
+    const double b = srgblut.Linear(bgr.val[B]);
+    const double x = (0.4124564 * r + 0.3575761 * g + 0.1804375 * b) / 0.95047;
+    const double y = 0.2126729 * r + 0.7151522 * g + 0.0721750 * b;
+    const double z = (0.0193339 * r + 0.1191920 * g + 0.9503041 * b) / 1.08883;
+    const double fx = lab_f(x);
+    const double fy = lab_f(y);
+    const double fz = lab_f(z);
+
+    return Scalar(116.0 * fy - 16.0, 500.0 * (fx - fy), 200.0 * (fy - fz));
+}
+
+double ChannelMetric::Compute(const Scalar &target, const Scalar &avg)
+{
+    auto colordiff_r = abs(target.val[R] - avg.val[R]);
+    auto colordiff_g = abs(target.val[G] - avg.val[G]);
+    auto colordiff_b = abs(target.val[B] - avg.val[B]);
+
+    return max(colordiff_r, max(colordiff_g, colordiff_b));
+}
+
+double DeltaE76Metric::Compute(const Scalar &target, const Scalar &avg)
+{
+    const Scalar lab1 = bgr_to_lab(target);
+    const Scalar lab2 = bgr_to_lab(avg);
+    const double deltal = lab1[0] - lab2[0];
+    const double deltaa = lab1[1] - lab2[1];
+    const double deltab = lab1[2] - lab2[2];
+    return sqrt(deltal * deltal + deltaa * deltaa + deltab * deltab);
+}
+
+/**
+ * brief CIEDE2000 difference of two CIELAB colors.
+ *
+ * Follows Sharma, Wu and Dalal, "The CIEDE2000 color-difference formula".
+ */
+static double ciede2000(const Scalar &lab1, const Scalar &lab2)
+{
+    const double pow25_7 = 6103515625.0;
+
+    const double cmean = (hypot(lab1[1], lab1[2]) + hypot(lab2[1], lab2[2])) / 2.0;
+    const double cmean7 = pow(cmean, 7.0);
+    const double gfactor = 0.5 * (1.0 - sqrt(cmean7 / (cmean7 + pow25_7)));
+    const double a1 = (1.0 + gfactor) * lab1[1];
+    const double a2 = (1.0 + gfactor) * lab2[1];
+    const double c1 = hypot(a1, lab1[2]);
+    const double c2 = hypot(a2, lab2[2]);
+    double h1 = (0.0 == a1 && 0.0 == lab1[2]) ? 0.0 : degrees(atan2(lab1[2], a1));
+    double h2 = (0.0 == a2 && 0.0 == lab2[2]) ? 0.0 : degrees(atan2(lab2[2], a2));
+    h1 += (0.0 > h1) ? 360.0 : 0.0;
+    h2 += (0.0 > h2) ? 360.0 : 0.0;
+
+    const double deltal = lab2[0] - lab1[0];
+    const double deltac = c2 - c1;
+    double deltah = 0.0;
+    double hmean = h1 + h2;
+    if (0.0 != c1 * c2)
+    {
+        deltah = h2 - h1;
+        deltah += (180.0 < deltah) ? -360.0 : ((-180.0 > deltah) ? 360.0 : 0.0);
+        if (180.0 >= fabs(h1 - h2))
+        {
+            hmean = (h1 + h2) / 2.0;
+        }
+        else
+        {
+            hmean = (h1 + h2 + ((360.0 > h1 + h2) ? 360.0 : -360.0)) / 2.0;
+        }
+    }
+    const double deltahue = 2.0 * sqrt(c1 * c2) * sin(radians(deltah / 2.0));
+
+    const double lmean = (lab1[0] + lab2[0]) / 2.0;
+    const double cpmean = (c1 + c2) / 2.0;
+    const double cpmean7 = pow(cpmean, 7.0);
+    const double t = 1.0 - 0.17 * cos(radians(hmean - 30.0)) + 0.24 * cos(radians(2.0 * hmean)) +
+                     0.32 * cos(radians(3.0 * hmean + 6.0)) - 0.20 * cos(radians(4.0 * hmean - 63.0));
+    const double deltatheta = 30.0 * exp(-pow((hmean - 275.0) / 25.0, 2.0));
+    const double rc = 2.0 * sqrt(cpmean7 / (cpmean7 + pow25_7));
+    const double lmean50 = (lmean - 50.0) * (lmean - 50.0);
+    const double sl = 1.0 + 0.015 * lmean50 / sqrt(20.0 + lmean50);
+    const double sc = 1.0 + 0.045 * cpmean;
+    const double sh = 1.0 + 0.015 * cpmean * t;
+    const double rt = -sin(radians(2.0 * deltatheta)) * rc;
+
+    const double termc = deltac / sc;
+    const double termh = deltahue / sh;
+    return sqrt(pow(deltal / sl, 2.0) + termc * termc + termh * termh + rt * termc * termh);
+}
+
+double DeltaE2000Metric::Compute(const Scalar &target, const Scalar &avg)
+{
+    return ciede2000(bgr_to_lab(target), bgr_to_lab(avg));
+}
+
+/**
+ * brief Get the HSV hue of a color in degrees, 0 for grays.
+ */
+static double hue(const Scalar &bgr)
+{
+    const double r = bgr.val[R];
+    const double g = bgr.val[G];
+    const double b = bgr.val[B];
+    const double maxval = max(r, max(g, b));
+    const double chroma = maxval - min(r, min(g, b));
+    if (0.0 >= chroma)
+    {
+        return 0.0;
+    }
+    double h;
+    if (maxval == r)
+    {
+        h = fmod((g - b) / chroma, 6.0);
+    }
+    else if (maxval == g)
+    {
+        h = (b - r) / chroma + 2.0;
+    }
+    else
+    {
+        h = (r - g) / chroma + 4.0;
+    }
+    h *= 60.0;
+    return (0.0 > h) ? h + 360.0 : h;
+}
+
+double HueMetric::Compute(const Scalar &target, const Scalar &avg)
+{
+    const double diff = fabs(hue(target) - hue(avg));
+    return min(diff, 360.0 - diff);
+}
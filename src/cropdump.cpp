@@ -0,0 +1,350 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "cropdump.hpp"
+
+using namespace cv;
+using namespace std;
+
+static CropDumpFrame *slot_frame(uint8_t *map, const CropDumpHeader &header, const uint64_t frame)
+{
+    const size_t offset = sizeof(CropDumpHeader) + (frame % header.numslots) * header.slotsize;
+    return reinterpret_cast<CropDumpFrame *>(map + offset);
+}
+
+CropDump::CropDump() : fd(-1), map(nullptr), mapsize(0)
+{
+}
+
+CropDump::~CropDump()
+{
+    Close();
+}
+
+/**
+ * brief Create the dump file, replacing any earlier dump at the path.
+ *
+ * param path Where to create the file.
+ * param img_size Resolution of the analyzed frames.
+ * param regionset The color areas, whose crops are stored.
+ * param specs The color areas as given to the region set.
+ * param metric The metric the color areas are evaluated with.
+ * param numslots Number of frames to keep, fewer if they would not fit in
+ *        CROP_DUMP_MAX_BYTES.
+ * return True on success.
+ */
+bool CropDump::Open(
+    const string &path,
+    const Size &img_size,
+    const RegionSet &regionset,
+    const vector<RegionSpec> &specs,
+    const ColorMetricType metric,
+    const uint32_t numslots)
+{
+    assert(regionset.Size() == specs.size());
+    assert(0 < numslots);
+    Close();
+
+    CropDumpHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CROP_DUMP_MAGIC;
+    header.version = CROP_DUMP_VERSION;
+    header.width = img_size.width;
+    header.height = img_size.height;
+    header.metric = metric;
+    header.numregions = specs.size();
+    size_t slotsize = sizeof(CropDumpFrame);
+    for (size_t i = 0; i < specs.size(); i++)
+    {
+        const ColorArea &area = regionset.Region(i);
+        const Range rows = area.GetRowRange();
+        const Range cols = area.GetColumnRange();
+        CropDumpRegion &region = header.regions[i];
+        region.centerx = specs[i].center.x;
+        region.centery = specs[i].center.y;
+        region.markerwidth = specs[i].markerwidth;
+        region.markerheight = specs[i].markerheight;
+        region.shape = specs[i].markershape;
+        region.tolerance = area.GetTolerance();
+        for (int c = B; c <= R; c++)
+        {
+            region.color[c] = area.GetColor().val[c];
+        }
+        region.x = cols.start & ~1;
+        region.y = rows.start & ~1;
+        region.width = min(img_size.width, (cols.end + 1) & ~1) - region.x;
+        region.height = min(img_size.height, (rows.end + 1) & ~1) - region.y;
+        region.offset = slotsize;
+        slotsize += region.width * region.height * 3 / 2;
+    }
+    header.slotsize = (slotsize + 7) & ~(size_t)7;
+    header.numslots = numslots;
+    const size_t maxslots = (CROP_DUMP_MAX_BYTES - sizeof(header)) / header.slotsize;
+    if (maxslots < numslots)
+    {
+        header.numslots = max<size_t>(1, maxslots);
+        LOG_I(
+            "%s/%s: Crops of %u frames take more than %u bytes, keeping %u frames",
+            __FILE__,
+            __FUNCTION__,
+            numslots,
+            CROP_DUMP_MAX_BYTES,
+            header.numslots);
+    }
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (0 > fd)
+    {
+        LOG_E("%s/%s: Failed to create %s (%s)", __FILE__, __FUNCTION__, path.c_str(), strerror(errno));
+        return false;
+    }
+    mapsize = sizeof(header) + (size_t)header.numslots * header.slotsize;
+    if (0 != ftruncate(fd, mapsize))
+    {
+        LOG_E("%s/%s: Failed to size %s (%s)", __FILE__, __FUNCTION__, path.c_str(), strerror(errno));
+        Close();
+        return false;
+    }
+    void *mapped = mmap(nullptr, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mapped)
+    {
+        LOG_E("%s/%s: Failed to map %s (%s)", __FILE__, __FUNCTION__, path.c_str(), strerror(errno));
+        Close();
+        return false;
+    }
+    map = static_cast<uint8_t *>(mapped);
+    memcpy(map, &header, sizeof(header));
+    LOG_I(
+        "%s/%s: Dumping the crops of %u color areas in %u frames of %u bytes to %s",
+        __FILE__,
+        __FUNCTION__,
+        header.numregions,
+        header.numslots,
+        header.slotsize,
+        path.c_str());
+    return true;
+}
+
+void CropDump::Close()
+{
+    if (nullptr != map)
+    {
+        munmap(map, mapsize);
+        map = nullptr;
+    }
+    if (0 <= fd)
+    {
+        close(fd);
+        fd = -1;
+    }
+    mapsize = 0;
+}
+
+bool CropDump::IsOpen() const
+{
+    return nullptr != map;
+}
+
+/**
+ * brief Store the crops of a frame in the oldest slot.
+ *
+ * param nv12_img The frame, with the resolution the dump was opened for.
+ * param states CropDumpState bits of each color area.
+ * param timestamp When the frame was received.
+ */
+void CropDump::Write(const Mat &nv12_img, const uint8_t *states, const int64_t timestamp)
+{
+    assert(IsOpen());
+    CropDumpHeader &header = *reinterpret_cast<CropDumpHeader *>(map);
+    assert((int)header.width == nv12_img.cols && (int)header.height * 3 / 2 == nv12_img.rows);
+
+    // A reader sees the slot as incomplete until the sequence is set
+    const uint64_t number = header.written;
+    CropDumpFrame *frame = slot_frame(map, header, number);
+    __atomic_store_n(&frame->sequence, UINT64_MAX, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    frame->timestamp = timestamp;
+    memcpy(frame->states, states, header.numregions);
+    uint8_t *slot = reinterpret_cast<uint8_t *>(frame);
+    for (uint32_t i = 0; i < header.numregions; i++)
+    {
+        const CropDumpRegion &region = header.regions[i];
+        uint8_t *dst = slot + region.offset;
+        for (int row = region.y; row < region.y + region.height; row++)
+        {
+            memcpy(dst, nv12_img.ptr<uint8_t>(row) + region.x, region.width);
+            dst += region.width;
+        }
+        // A UV row holds the interleaved pairs of two luma rows
+        for (int row = region.y / 2; row < (region.y + region.height) / 2; row++)
+        {
+            memcpy(dst, nv12_img.ptr<uint8_t>(header.height + row) + region.x, region.width);
+            dst += region.width;
+        }
+    }
+    __atomic_store_n(&frame->sequence, number, __ATOMIC_RELEASE);
+    __atomic_store_n(&header.written, number + 1, __ATOMIC_RELEASE);
+}
+
+CropDumpReader::CropDumpReader() : fd(-1), map(nullptr), mapsize(0)
+{
+}
+
+CropDumpReader::~CropDumpReader()
+{
+    if (nullptr != map)
+    {
+        munmap(const_cast<uint8_t *>(map), mapsize);
+    }
+    if (0 <= fd)
+    {
+        close(fd);
+    }
+}
+
+/**
+ * brief Map a crop dump and check that it is complete.
+ *
+ * param path The dump file.
+ * return True if the file is a crop dump this version can read.
+ */
+bool CropDumpReader::Open(const string &path)
+{
+    assert(nullptr == map);
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (0 > fd || 0 != fstat(fd, &st))
+    {
+        LOG_E("%s/%s: Failed to open %s (%s)", __FILE__, __FUNCTION__, path.c_str(), strerror(errno));
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(CropDumpHeader))
+    {
+        LOG_E("%s/%s: %s is too short for a crop dump", __FILE__, __FUNCTION__, path.c_str());
+        return false;
+    }
+    mapsize = st.st_size;
+    void *mapped = mmap(nullptr, mapsize, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mapped)
+    {
+        LOG_E("%s/%s: Failed to map %s (%s)", __FILE__, __FUNCTION__, path.c_str(), strerror(errno));
+        return false;
+    }
+    map = static_cast<const uint8_t *>(mapped);
+
+    const CropDumpHeader &header = Header();
+    bool valid = CROP_DUMP_MAGIC == header.magic && CROP_DUMP_VERSION == header.version && 0 < header.numslots &&
+                 MAX_REGIONS >= header.numregions && 0 == header.width % 2 && 0 == header.height % 2 &&
+                 sizeof(CropDumpFrame) <= header.slotsize &&
+                 mapsize >= sizeof(CropDumpHeader) + (size_t)header.numslots * header.slotsize;
+    for (uint32_t i = 0; valid && i < header.numregions; i++)
+    {
+        const CropDumpRegion &region = header.regions[i];
+        valid = MarkerCount > region.shape && 0 <= region.x && 0 <= region.y && 0 <= region.width &&
+                0 <= region.height && region.x + region.width <= (int)header.width &&
+                region.y + region.height <= (int)header.height &&
+                region.offset + (size_t)region.width * region.height * 3 / 2 <= header.slotsize;
+    }
+    if (!valid)
+    {
+        LOG_E("%s/%s: %s is not a valid crop dump", __FILE__, __FUNCTION__, path.c_str());
+        return false;
+    }
+    return true;
+}
+
+const CropDumpHeader &CropDumpReader::Header() const
+{
+    assert(nullptr != map);
+    return *reinterpret_cast<const CropDumpHeader *>(map);
+}
+
+/// Number of frames in the dump
+size_t CropDumpReader::Frames() const
+{
+    const CropDumpHeader &header = Header();
+    return min<uint64_t>(header.written, header.numslots);
+}
+
+/**
+ * brief Get the color areas of the dump, in the resolution of its frames.
+ */
+void CropDumpReader::GetSpecs(vector<RegionSpec> &specs) const
+{
+    const CropDumpHeader &header = Header();
+    specs.resize(header.numregions);
+    for (uint32_t i = 0; i < header.numregions; i++)
+    {
+        const CropDumpRegion &region = header.regions[i];
+        specs[i].center = Point(region.centerx, region.centery);
+        specs[i].color = Scalar(region.color[B], region.color[G], region.color[R]);
+        specs[i].markerwidth = region.markerwidth;
+        specs[i].markerheight = region.markerheight;
+        specs[i].markershape = region.shape;
+        specs[i].tolerance = region.tolerance;
+        specs[i].channel = DEFAULT_CHANNEL;
+    }
+}
+
+/**
+ * brief Copy the crops of a frame into a full frame.
+ *
+ * The samples outside the crops are left as they are.
+ *
+ * param frame Frame to render, 0 being the oldest one.
+ * param nv12_img NV12 frame of the resolution of the dump.
+ * return The frame header, or nullptr if the frame was not completely
+ *        written.
+ */
+const CropDumpFrame *CropDumpReader::Render(const size_t frame, Mat &nv12_img) const
+{
+    const CropDumpHeader &header = Header();
+    assert(frame < Frames());
+    assert((int)header.width == nv12_img.cols && (int)header.height * 3 / 2 == nv12_img.rows);
+
+    const uint64_t number = header.written - Frames() + frame;
+    const CropDumpFrame *dumped = slot_frame(const_cast<uint8_t *>(map), header, number);
+    if (number != dumped->sequence)
+    {
+        return nullptr;
+    }
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(dumped);
+    for (uint32_t i = 0; i < header.numregions; i++)
+    {
+        const CropDumpRegion &region = header.regions[i];
+        const uint8_t *samples = src + region.offset;
+        for (int row = region.y; row < region.y + region.height; row++)
+        {
+            memcpy(nv12_img.ptr<uint8_t>(row) + region.x, samples, region.width);
+            samples += region.width;
+        }
+        for (int row = region.y / 2; row < (region.y + region.height) / 2; row++)
+        {
+            memcpy(nv12_img.ptr<uint8_t>(header.height + row) + region.x, samples, region.width);
+            samples += region.width;
+        }
+    }
+    return dumped;
+}
@@ -14,8 +14,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <assert.h>
 #include <future>
+#include <stdint.h>
 #include <stdexcept>
 #include <vector>
 
@@ -34,12 +36,69 @@ static void declaration_complete(guint declaration, gpointer user_data)
     LOG_I("%s/%s: Event declaration complete!", __FILE__, __FUNCTION__);
 }
 
-AxEventHandler::AxEventHandler() : evhandler(ax_event_handler_new()), initialized(false)
+AxEventHandler::AxEventHandler()
+    : evhandler(ax_event_handler_new()), numcolorareas(0), interval_us(0), flushtimer(0), flushdue(0)
+{
+    // Only the data value varies between the events
+    for (int state = 0; state < 2; state++)
+    {
+        const gboolean active = state;
+        statesets[state] = ax_event_key_value_set_new();
+        ax_event_key_value_set_add_key_value(statesets[state], "active", NULL, &active, AX_VALUE_TYPE_BOOL, NULL);
+    }
+    SetNumColorAreas(1);
+}
+
+AxEventHandler::~AxEventHandler()
+{
+    assert(nullptr != evhandler);
+
+    if (0 != flushtimer)
+    {
+        g_source_remove(flushtimer);
+    }
+    SetNumColorAreas(0);
+    for (auto set : statesets)
+    {
+        ax_event_key_value_set_free(set);
+    }
+
+    LOG_I("%s/%s: Free eventhandler ...", __FILE__, __FUNCTION__);
+    ax_event_handler_free(evhandler);
+}
+
+/**
+ * brief Set the number of color areas to declare events for.
+ *
+ * The first color area keeps the original event declaration, additional
+ * color areas are declared with a Region source key holding their index.
+ *
+ * param count Number of color areas.
+ */
+void AxEventHandler::SetNumColorAreas(const size_t count)
+{
+    assert(MAX_REGIONS >= count);
+    for (size_t i = numcolorareas; i < count; i++)
+    {
+        Declare(i);
+        sentstate[i] = false;
+        senttime[i] = 0;
+        pending[i] = false;
+    }
+    for (size_t i = count; i < numcolorareas; i++)
+    {
+        Undeclare(i);
+    }
+    numcolorareas = count;
+}
+
+void AxEventHandler::Declare(const size_t index)
 {
     GError *error = nullptr;
 
     // Create keys, namespaces, and nice names for the event
     const bool falsebool = false;
+    const int region = index;
     AXEventKeyValueSet *set = ax_event_key_value_set_new();
     // clang-format off
     ax_event_key_value_set_add_key_values(set, &error,
@@ -49,6 +108,10 @@ AxEventHandler::AxEventHandler() : evhandler(ax_event_handler_new()), initialize
         "active", NULL, &falsebool, AX_VALUE_TYPE_BOOL,
          NULL);
     // clang-format on
+    if (nullptr == error && 0 < index)
+    {
+        ax_event_key_value_set_add_key_value(set, "Region", NULL, &region, AX_VALUE_TYPE_INT, &error);
+    }
 
     if (nullptr != error)
     {
@@ -63,17 +126,23 @@ AxEventHandler::AxEventHandler() : evhandler(ax_event_handler_new()), initialize
     ax_event_key_value_set_add_nice_names(set, "topic2", "tnsaxis", NULL, "Color Checker", NULL);
     ax_event_key_value_set_add_nice_names(set, "active", NULL, NULL, "Within tolerance", NULL);
 
-    // Mark data value
+    // Mark data value and the source telling the color areas apart
     ax_event_key_value_set_mark_as_data(set, "active", NULL, NULL);
+    if (0 < index)
+    {
+        ax_event_key_value_set_add_nice_names(set, "Region", NULL, NULL, "Region", NULL);
+        ax_event_key_value_set_mark_as_source(set, "Region", NULL, NULL);
+    }
 
     // Declare event
+    initialized[index] = false;
     if (!ax_event_handler_declare(
             evhandler,
             set,
             FALSE, // define stateful event
-            &eventid,
+            &eventid[index],
             declaration_complete,
-            &initialized,
+            &initialized[index],
             &error))
     {
         LOG_E("%s/%s: Could not declare: %s", __FILE__, __FUNCTION__, error->message);
@@ -85,42 +154,136 @@ AxEventHandler::AxEventHandler() : evhandler(ax_event_handler_new()), initialize
     ax_event_key_value_set_free(set);
 }
 
-AxEventHandler::~AxEventHandler()
+void AxEventHandler::Undeclare(const size_t index)
 {
-    assert(nullptr != evhandler);
-    assert(0 != eventid);
+    assert(0 != eventid[index]);
 
-    LOG_I("%s/%s: Undeclare event ...", __FILE__, __FUNCTION__);
-    ax_event_handler_undeclare(evhandler, eventid, nullptr);
+    LOG_I("%s/%s: Undeclare event %zu ...", __FILE__, __FUNCTION__, index);
+    ax_event_handler_undeclare(evhandler, eventid[index], nullptr);
+    eventid[index] = 0;
+    initialized[index] = false;
+}
 
-    LOG_I("%s/%s: Free eventhandler ...", __FILE__, __FUNCTION__);
-    ax_event_handler_free(evhandler);
+/**
+ * brief Set the shortest time between two events of a color area.
+ *
+ * param interval_ms The interval, 0 sends every state change right away.
+ */
+void AxEventHandler::SetInterval(const uint32_t interval_ms)
+{
+    interval_us = (int64_t)interval_ms * 1000;
+
+    // Let what is pending go out by the new interval
+    if (0 != flushtimer)
+    {
+        g_source_remove(flushtimer);
+        flushtimer = 0;
+        FlushEntry(this);
+    }
 }
 
-void AxEventHandler::Send(const gboolean active) const
+/**
+ * brief Report the state of a color area.
+ *
+ * The event is sent right away unless the last event of the color area was
+ * sent within the interval. Then the state is kept and sent when the interval
+ * has passed, unless it had gone back to the state last sent by then.
+ *
+ * param index The color area.
+ * param active Whether the color area is within tolerance.
+ */
+void AxEventHandler::Send(const size_t index, const gboolean active)
 {
-    if (!initialized)
+    assert(index < numcolorareas);
+    if (!initialized[index])
     {
-        LOG_I("%s/%s: Event handling not yet initialized", __FILE__, __FUNCTION__);
+        LOG_I_LIMITED("%s/%s: Event handling not yet initialized", __FILE__, __FUNCTION__);
         return;
     }
 
-    auto set = ax_event_key_value_set_new();
-
-    // Add the variable elements of the event to the set
-    ax_event_key_value_set_add_key_value(set, "active", NULL, &active, AX_VALUE_TYPE_BOOL, NULL);
-
-    // Create the event
-    auto event = ax_event_new2(set, NULL);
+    const int64_t now = g_get_monotonic_time();
+    const int64_t due = senttime[index] + interval_us;
+    if (0 < interval_us && 0 < senttime[index] && now < due)
+    {
+        pending[index] = true;
+        pendingstate[index] = active;
+        ScheduleFlush(due);
+        return;
+    }
+    pending[index] = false;
+    SendNow(index, active);
+}
 
-    // The key/value set is no longer needed
-    ax_event_key_value_set_free(set);
+void AxEventHandler::SendNow(const size_t index, const bool active)
+{
+    // The event copies the set and is stamped with the current time
+    auto event = ax_event_new2(statesets[active], NULL);
 
     // Send the event
     assert(nullptr != evhandler);
-    ax_event_handler_send_event(evhandler, eventid, event, NULL);
+    ax_event_handler_send_event(evhandler, eventid[index], event, NULL);
+    ax_event_free(event);
+    sentstate[index] = active;
+    senttime[index] = g_get_monotonic_time();
 
-    LOG_I("%s/%s: Stateful event (%s tolerance) sent", __FILE__, __FUNCTION__, active ? "within" : "exceeds");
+    LOG_I_LIMITED(
+        "%s/%s: Stateful event %zu (%s tolerance) sent",
+        __FILE__,
+        __FUNCTION__,
+        index,
+        active ? "within" : "exceeds");
+}
 
-    ax_event_free(event);
+/**
+ * brief Make sure the pending events are looked at no later than due.
+ */
+void AxEventHandler::ScheduleFlush(const int64_t due)
+{
+    if (0 != flushtimer)
+    {
+        if (flushdue <= due)
+        {
+            return;
+        }
+        g_source_remove(flushtimer);
+    }
+    const int64_t delay_ms = (due - g_get_monotonic_time() + 999) / 1000;
+    flushdue = due;
+    flushtimer = g_timeout_add((guint)max<int64_t>(0, delay_ms), FlushEntry, this);
+}
+
+/**
+ * brief Send the pending events whose interval has passed.
+ */
+gboolean AxEventHandler::FlushEntry(gpointer data)
+{
+    AxEventHandler *handler = static_cast<AxEventHandler *>(data);
+    handler->flushtimer = 0;
+
+    const int64_t now = g_get_monotonic_time();
+    int64_t nextdue = INT64_MAX;
+    for (size_t i = 0; i < handler->numcolorareas; i++)
+    {
+        if (!handler->pending[i])
+        {
+            continue;
+        }
+        const int64_t due = handler->senttime[i] + handler->interval_us;
+        if (due > now)
+        {
+            nextdue = min(nextdue, due);
+            continue;
+        }
+        handler->pending[i] = false;
+        if (handler->pendingstate[i] != handler->sentstate[i] && handler->initialized[i])
+        {
+            handler->SendNow(i, handler->pendingstate[i]);
+        }
+    }
+    if (INT64_MAX != nextdue)
+    {
+        handler->ScheduleFlush(nextdue);
+    }
+
+    return G_SOURCE_REMOVE;
 }
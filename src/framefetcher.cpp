@@ -0,0 +1,219 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file handles the fetching of frames from all VDO streams.
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <errno.h>
+#include <mutex>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common.hpp"
+#include "framefetcher.hpp"
+#include "imgprovider.hpp"
+
+using namespace std;
+
+// Providers fetched from and the state of the thread, guarded by fetchermtx
+static mutex fetchermtx;
+static vector<ImgProvider *> providers;
+static pthread_t fetcherthread;
+static bool running = false;
+// Written to wake up the thread, also from signal handlers
+static atomic<int> wakefd(-1);
+
+/**
+ * brief Start fetching frames from a provider.
+ *
+ * The thread is started with the first provider.
+ *
+ * param provider Initialized provider with a non-blocking stream.
+ * return False if the provider could not be added.
+ */
+bool FrameFetcher::Add(ImgProvider &provider)
+{
+    lock_guard<mutex> lock(fetchermtx);
+    if (MAX_FETCHED_STREAMS <= providers.size())
+    {
+        LOG_E("%s/%s: Too many streams (max %u)", __FILE__, __FUNCTION__, MAX_FETCHED_STREAMS);
+        return false;
+    }
+    if (!running)
+    {
+        const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (0 > fd)
+        {
+            LOG_E("%s/%s: Failed to create eventfd: %s", __FILE__, __FUNCTION__, strerror(errno));
+            return false;
+        }
+        wakefd = fd;
+        providers.reserve(MAX_FETCHED_STREAMS);
+        running = true;
+        if (pthread_create(&fetcherthread, nullptr, threadEntry, nullptr))
+        {
+            LOG_E("%s/%s: Failed to start thread fetching frames: %s", __FILE__, __FUNCTION__, strerror(errno));
+            running = false;
+            wakefd = -1;
+            close(fd);
+            return false;
+        }
+    }
+    providers.push_back(&provider);
+    Wake();
+
+    return true;
+}
+
+/**
+ * brief Stop fetching frames from a provider.
+ *
+ * The provider is not touched by the thread once this returns. The thread is
+ * stopped with the last provider.
+ *
+ * param provider Provider to remove, may be one that was never added.
+ */
+void FrameFetcher::Remove(ImgProvider &provider)
+{
+    unique_lock<mutex> lock(fetchermtx);
+    auto it = find(providers.begin(), providers.end(), &provider);
+    if (providers.end() == it)
+    {
+        return;
+    }
+    providers.erase(it);
+    if (!providers.empty())
+    {
+        Wake();
+        return;
+    }
+
+    running = false;
+    Wake();
+    lock.unlock();
+    if (pthread_join(fetcherthread, nullptr))
+    {
+        LOG_E("%s/%s: Failed to join thread fetching frames: %s", __FILE__, __FUNCTION__, strerror(errno));
+    }
+    close(wakefd.exchange(-1));
+}
+
+/**
+ * brief Wake up the thread to pick up changed providers.
+ *
+ * Async-signal-safe, so a signal handler can stop a provider.
+ */
+void FrameFetcher::Wake()
+{
+    const int fd = wakefd;
+    if (0 <= fd)
+    {
+        // Writing only fails when the counter is about to overflow, and then
+        // the thread is woken up anyway
+        const uint64_t one = 1;
+        const ssize_t written = write(fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/**
+ * brief Starting point function for the thread fetching frames.
+ *
+ * The thread works roughly like this:
+ * 1. The file descriptors of all running providers, and the eventfd, are
+ *    collected under the lock.
+ * 2. The thread blocks in poll() without the lock until some stream has a
+ *    frame or the thread is woken up.
+ * 3. Under the lock, a frame is fetched from each stream that has one and
+ *    whose provider is still there.
+ * A stream reporting an error is stopped, so that its client sees the end of
+ * the frames instead of the thread spinning on it.
+ *
+ * param data Unused.
+ * return Pointer to unused return data.
+ */
+void *FrameFetcher::threadEntry(void *data)
+{
+    (void)data;
+    struct pollfd fds[MAX_FETCHED_STREAMS + 1];
+    ImgProvider *polled[MAX_FETCHED_STREAMS];
+
+    for (;;)
+    {
+        nfds_t count = 0;
+        fetchermtx.lock();
+        if (!running)
+        {
+            fetchermtx.unlock();
+            break;
+        }
+        fds[0].fd = wakefd;
+        fds[0].events = POLLIN;
+        for (auto provider : providers)
+        {
+            if (!provider->shutdown)
+            {
+                polled[count++] = provider;
+                fds[count].fd = provider->Fd();
+                fds[count].events = POLLIN;
+            }
+        }
+        fetchermtx.unlock();
+
+        if (0 > poll(fds, count + 1, -1))
+        {
+            if (EINTR != errno)
+            {
+                LOG_E("%s/%s: Failed to poll streams: %s", __FILE__, __FUNCTION__, strerror(errno));
+            }
+            continue;
+        }
+        if (0 != (fds[0].revents & POLLIN))
+        {
+            // Reset the counter, the providers are collected again anyway
+            uint64_t wakeups;
+            const ssize_t readsize = read(fds[0].fd, &wakeups, sizeof(wakeups));
+            (void)readsize;
+        }
+
+        lock_guard<mutex> lock(fetchermtx);
+        for (nfds_t i = 0; i < count; i++)
+        {
+            const short events = fds[i + 1].revents;
+            ImgProvider *provider = polled[i];
+            if (0 == events || provider->shutdown ||
+                providers.end() == find(providers.begin(), providers.end(), provider))
+            {
+                continue;
+            }
+            if (0 != (events & (POLLERR | POLLHUP | POLLNVAL)))
+            {
+                LOG_E("%s/%s: Stream of channel %u failed, stopping it", __FILE__, __FUNCTION__, provider->Channel());
+                ImgProvider::StopFrameFetch(*provider);
+                continue;
+            }
+            provider->FetchFrame();
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,131 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+
+#include "framehandle.hpp"
+
+using namespace cv;
+
+FrameHandle::FrameHandle() : provider(nullptr), buffer(nullptr)
+{
+}
+
+/**
+ * brief Take ownership of a frame.
+ *
+ * param provider The provider the buffer is returned to.
+ * param buffer Frame from the provider, or nullptr for an empty handle.
+ */
+FrameHandle::FrameHandle(ImgProvider &provider, VdoBuffer *buffer) : provider(&provider), buffer(buffer)
+{
+    if (nullptr == buffer)
+    {
+        return;
+    }
+
+    // The UV plane follows the Y plane, both with the stride of the stream
+    uint8_t *data = static_cast<uint8_t *>(vdo_buffer_get_data(buffer));
+    const int width = provider.Width();
+    const int height = provider.Height();
+    const size_t pitch = provider.Pitch();
+    nv12 = Mat(height * 3 / 2, width, CV_8UC1, data, pitch);
+    y = Mat(height, width, CV_8UC1, data, pitch);
+    uv = Mat(height / 2, width / 2, CV_8UC2, data + pitch * height, pitch);
+}
+
+FrameHandle::FrameHandle(FrameHandle &&other)
+    : provider(other.provider), buffer(other.buffer), nv12(other.nv12), y(other.y), uv(other.uv)
+{
+    other.buffer = nullptr;
+    other.nv12 = Mat();
+    other.y = Mat();
+    other.uv = Mat();
+}
+
+FrameHandle &FrameHandle::operator=(FrameHandle &&other)
+{
+    if (this != &other)
+    {
+        Release();
+        provider = other.provider;
+        buffer = other.buffer;
+        nv12 = other.nv12;
+        y = other.y;
+        uv = other.uv;
+        other.buffer = nullptr;
+        other.nv12 = Mat();
+        other.y = Mat();
+        other.uv = Mat();
+    }
+    return *this;
+}
+
+FrameHandle::~FrameHandle()
+{
+    Release();
+}
+
+/**
+ * brief Wait for the most recent frame of a provider.
+ *
+ * param provider The provider.
+ * return Handle of the frame, empty if no frame came in time.
+ */
+FrameHandle FrameHandle::Acquire(ImgProvider &provider)
+{
+    return FrameHandle(provider, ImgProvider::GetLastFrameBlocking(provider));
+}
+
+bool FrameHandle::Valid() const
+{
+    return nullptr != buffer;
+}
+
+const Mat &FrameHandle::Nv12() const
+{
+    assert(Valid());
+    return nv12;
+}
+
+const Mat &FrameHandle::Y() const
+{
+    assert(Valid());
+    return y;
+}
+
+const Mat &FrameHandle::UV() const
+{
+    assert(Valid());
+    return uv;
+}
+
+/**
+ * brief Return the frame to the provider and clear the views.
+ */
+void FrameHandle::Release()
+{
+    if (nullptr == buffer)
+    {
+        return;
+    }
+    nv12 = Mat();
+    y = Mat();
+    uv = Mat();
+    assert(nullptr != provider);
+    ImgProvider::ReturnFrame(*provider, *buffer);
+    buffer = nullptr;
+}
@@ -20,13 +20,19 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 #include <vdo-channel.h>
 
 #include "common.hpp"
+#include "framefetcher.hpp"
 #include "imgprovider.hpp"
+#include "metrics.hpp"
+#include "vdo-error.h"
+#include "vdo-frame.h"
 #include "vdo-map.h"
 
-#define VDO_CHANNEL (1)
+// Longest time a client waits for a frame before giving up
+#define FRAME_WAIT_TIMEOUT_MS (1000)
 
 /**
  * brief Constructor
@@ -35,79 +41,51 @@
  * find resolution of the created stream. These numbers might not match the
  * requested resolution depending on platform properties.
  *
+ * param channel VDO channel (view area or sensor) to stream, starting at 1.
  * param width Requested output image width.
  * param height Requested ouput image height.
- * param numFrames Number of fetched frames to keep.
+ * param framerate Requested frame rate of the stream.
  * param vdoFormat Image format to be output by stream.
  */
 ImgProvider::ImgProvider(
+    const unsigned int channel,
     const unsigned int width,
     const unsigned int height,
-    const unsigned int numFrames,
+    const double framerate,
     const VdoFormat format)
-    : shutdown(false), initialized(false), width(width), height(height), num_app_frames(numFrames), vdo_format(format)
+    : latest_frame(nullptr), shutdown(false), initialized(false), channel(channel), width(width), height(height),
+      pitch(width), framerate(framerate), vdo_format(format), vdo_stream(nullptr), vdo_fd(-1)
 {
 }
 
 ImgProvider::~ImgProvider()
 {
+    // Make sure the frame fetcher is done with this provider
+    FrameFetcher::Remove(*this);
     ImgProvider::ReleaseVdoBuffers(*this);
 
-    pthread_mutex_destroy(&frame_mutex);
-    pthread_cond_destroy(&frame_deliver_cond);
-
-    if (delivered_frames)
-    {
-        g_queue_free(delivered_frames);
-    }
-    if (processed_frames)
+    if (initialized)
     {
-        g_queue_free(processed_frames);
+        sem_destroy(&frame_ready);
     }
 }
 
 bool ImgProvider::InitImgProvider()
 {
-    if (pthread_mutex_init(&frame_mutex, nullptr))
+    if (sem_init(&frame_ready, 0, 0))
     {
-        LOG_E("%s: Unable to initialize mutex: %s", __func__, strerror(errno));
+        LOG_E("%s: Unable to initialize semaphore: %s", __func__, strerror(errno));
         return false;
     }
 
-    if (pthread_cond_init(&frame_deliver_cond, nullptr))
-    {
-        LOG_E("%s: Unable to initialize condition variable: %s", __func__, strerror(errno));
-        goto error_mtx;
-    }
-
-    delivered_frames = g_queue_new();
-    if (!delivered_frames)
-    {
-        LOG_E("%s: Unable to create delivered_frames queue!", __func__);
-        goto error_cond;
-    }
-
-    processed_frames = g_queue_new();
-    if (!processed_frames)
-    {
-        LOG_E("%s: Unable to create processed_frames queue!", __func__);
-        goto error_cond;
-    }
-
     if (!CreateStream(*this))
     {
         LOG_E("%s: Could not create VDO stream!", __func__);
-        goto error_cond;
+        sem_destroy(&frame_ready);
+        return false;
     }
 
     initialized = true;
-    goto exit;
-
-error_cond:
-    pthread_cond_destroy(&frame_deliver_cond);
-error_mtx:
-    pthread_mutex_destroy(&frame_mutex);
-exit:
     return initialized;
 }
 
@@ -118,32 +96,39 @@ exit:
  * fits the requested width and height. If no valid resolutions are reported
  * by VDO then the original w/h are returned as chosenWidth/chosenHeight.
  *
+ * param channel VDO channel to get the resolutions of.
  * param reqWidth Requested image width.
  * param reqHeight Requested image height.
  * param chosenWidth Selected image width.
  * param chosenHeight Selected image height.
+ * param aspectWidth If nonzero, only resolutions with the aspect ratio
+ *        aspectWidth:aspectHeight are considered.
+ * param aspectHeight See aspectWidth.
  * return False if any errors occur, otherwise true.
  */
 bool ImgProvider::ChooseStreamResolution(
+    const unsigned int channel,
     const unsigned int reqWidth,
     const unsigned int reqHeight,
     unsigned int &chosenWidth,
-    unsigned int &chosenHeight)
+    unsigned int &chosenHeight,
+    const unsigned int aspectWidth,
+    const unsigned int aspectHeight)
 {
     VdoResolutionSet *set = nullptr;
-    VdoChannel *channel = nullptr;
+    VdoChannel *vdoChannel = nullptr;
     GError *error = nullptr;
 
     // Retrieve channel resolutions
-    channel = vdo_channel_get(VDO_CHANNEL, &error);
-    if (!channel)
+    vdoChannel = vdo_channel_get(channel, &error);
+    if (!vdoChannel)
     {
-        LOG_E("%s: Failed vdo_channel_get(): %s", __func__, (error != nullptr) ? error->message : "N/A");
-        g_clear_object(&channel);
+        LOG_E("%s: Failed vdo_channel_get(%u): %s", __func__, channel, (error != nullptr) ? error->message : "N/A");
+        g_clear_object(&vdoChannel);
         g_clear_error(&error);
     }
-    set = vdo_channel_get_resolutions(channel, nullptr, &error);
-    g_clear_object(&channel);
+    set = vdo_channel_get_resolutions(vdoChannel, nullptr, &error);
+    g_clear_object(&vdoChannel);
     if (nullptr == set)
     {
         LOG_E(
@@ -163,7 +148,9 @@ bool ImgProvider::ChooseStreamResolution(
         VdoResolution *res = &set->resolutions[i];
         assert(nullptr != res);
         LOG_I("%s/%s: resolution %zu: (%ux%u)", __FILE__, __FUNCTION__, i, res->width, res->height);
-        if ((res->width >= reqWidth) && (res->height >= reqHeight))
+        const bool aspectmatch =
+            0 == aspectWidth || (guint64)res->width * aspectHeight == (guint64)res->height * aspectWidth;
+        if (aspectmatch && (res->width >= reqWidth) && (res->height >= reqHeight))
         {
             unsigned int area = res->width * res->height;
             if (area < bestResolutionArea)
@@ -178,7 +165,7 @@ bool ImgProvider::ChooseStreamResolution(
     // for creating the stream. If that info for some reason was empty we
     // fall back to trying to create a stream with client-supplied w/h.
     chosenWidth = reqWidth;
-    chosenWidth = reqHeight;
+    chosenHeight = reqHeight;
     if (bestResolutionIdx >= 0)
     {
         chosenWidth = set->resolutions[bestResolutionIdx].width;
@@ -218,6 +205,7 @@ bool ImgProvider::CreateStream(ImgProvider &provider)
 {
     assert(!provider.initialized);
     VdoMap *vdoMap = vdo_map_new();
+    VdoMap *streamInfo = nullptr;
     GError *error = nullptr;
     bool ret = false;
 
@@ -227,12 +215,15 @@ bool ImgProvider::CreateStream(ImgProvider &provider)
         return ret;
     }
 
-    vdo_map_set_uint32(vdoMap, "channel", VDO_CHANNEL);
+    vdo_map_set_uint32(vdoMap, "channel", provider.channel);
     vdo_map_set_uint32(vdoMap, "format", provider.vdo_format);
     vdo_map_set_uint32(vdoMap, "width", provider.width);
     vdo_map_set_uint32(vdoMap, "height", provider.height);
+    vdo_map_set_double(vdoMap, "framerate", provider.framerate);
     // We will use buffer_alloc() and buffer_unref() calls.
     vdo_map_set_uint32(vdoMap, "buffer.strategy", VDO_BUFFER_STRATEGY_EXPLICIT);
+    // The frame fetcher polls the stream instead of blocking on it
+    vdo_map_set_boolean(vdoMap, "socket.blocking", FALSE);
 
     LOG_I("Dump of vdo stream settings map =====");
     vdo_map_dump(vdoMap);
@@ -261,6 +252,33 @@ bool ImgProvider::CreateStream(ImgProvider &provider)
 
     provider.vdo_stream = vdo_stream;
 
+    provider.vdo_fd = vdo_stream_get_fd(vdo_stream, &error);
+    if (0 > provider.vdo_fd)
+    {
+        LOG_E("%s: Failed to get stream fd: %s", __func__, (error != nullptr) ? error->message : "N/A");
+        goto create_exit;
+    }
+
+    // Rows may be padded, so get the actual stride of the frames
+    streamInfo = vdo_stream_get_info(vdo_stream, &error);
+    if (nullptr == streamInfo)
+    {
+        LOG_E("%s: Failed to get stream info: %s", __func__, (error != nullptr) ? error->message : "N/A");
+        g_clear_error(&error);
+    }
+    else
+    {
+        provider.pitch = vdo_map_get_uint32(streamInfo, "pitch", provider.width);
+        g_object_unref(streamInfo);
+    }
+    LOG_I(
+        "%s: Stream of %u x %u with pitch %u on channel %u",
+        __func__,
+        provider.width,
+        provider.height,
+        provider.pitch,
+        provider.channel);
+
     ret = true;
 
 create_exit:
@@ -349,163 +367,216 @@ void ImgProvider::ReleaseVdoBuffers(ImgProvider &provider)
 /**
  * brief Get the most recent frame the thread has fetched from VDO.
  *
+ * Blocks until a frame is available, the frame fetching is stopped or
+ * FRAME_WAIT_TIMEOUT_MS has passed.
+ *
  * param provider Reference to an ImgProvider fetching frames.
  * return Pointer to an image buffer on success, otherwise nullptr.
  */
 VdoBuffer *ImgProvider::GetLastFrameBlocking(ImgProvider &provider)
 {
     assert(provider.initialized);
-    VdoBuffer *returnBuf = nullptr;
-    pthread_mutex_lock(&provider.frame_mutex);
+    const int64_t start = Metrics::Now();
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += FRAME_WAIT_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (FRAME_WAIT_TIMEOUT_MS % 1000) * 1000000L;
+    if (1000000000L <= deadline.tv_nsec)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
 
-    while (g_queue_get_length(provider.delivered_frames) < 1)
+    while (0 != sem_timedwait(&provider.frame_ready, &deadline))
     {
-        if (pthread_cond_wait(&provider.frame_deliver_cond, &provider.frame_mutex))
+        if (EINTR != errno)
         {
-            LOG_E("%s: Failed to wait on condition: %s", __func__, strerror(errno));
-            goto error_exit;
+            if (ETIMEDOUT != errno)
+            {
+                LOG_E("%s: Failed to wait for frame: %s", __func__, strerror(errno));
+            }
+            return nullptr;
         }
     }
 
-    returnBuf = (VdoBuffer *)g_queue_pop_tail(provider.delivered_frames);
-
-error_exit:
-    pthread_mutex_unlock(&provider.frame_mutex);
-
-    return returnBuf;
+    // Each post of the semaphore corresponds to a frame put in an empty slot
+    // (or to the shutdown).
+    VdoBuffer *buffer = provider.latest_frame.exchange(nullptr);
+    if (nullptr != buffer)
+    {
+        Metrics::Record(StageWait, start, Metrics::Now());
+    }
+    return buffer;
 }
 
 void ImgProvider::ReturnFrame(ImgProvider &provider, VdoBuffer &buffer)
 {
     assert(provider.initialized);
-    pthread_mutex_lock(&provider.frame_mutex);
 
-    g_queue_push_tail(provider.processed_frames, &buffer);
+    // Can never be full since it holds all buffers
+    const bool pushed = provider.processed_frames.Push(&buffer);
+    assert(pushed);
+    (void)pushed;
+}
 
-    pthread_mutex_unlock(&provider.frame_mutex);
+unsigned int ImgProvider::Width() const
+{
+    return width;
 }
 
-void ImgProvider::RunLoopIteration()
+unsigned int ImgProvider::Height() const
 {
-    assert(initialized);
-    GError *error = nullptr;
-    // Block waiting for a frame from VDO
-    VdoBuffer *newBuffer = vdo_stream_get_buffer(vdo_stream, &error);
+    return height;
+}
 
-    if (!newBuffer)
+unsigned int ImgProvider::Pitch() const
+{
+    return pitch;
+}
+
+unsigned int ImgProvider::Channel() const
+{
+    return channel;
+}
+
+int ImgProvider::Fd() const
+{
+    return vdo_fd;
+}
+
+void ImgProvider::EnqueueBuffer(VdoBuffer *buffer)
+{
+    GError *error = nullptr;
+    if (!vdo_stream_buffer_enqueue(vdo_stream, buffer, &error))
     {
         // Fail but we continue anyway hoping for the best.
         syslog(
             LOG_WARNING,
-            "%s: Failed fetching frame from vdo: %s",
+            "%s: Failed enqueueing buffer to vdo: %s",
             __func__,
             (error != nullptr) ? error->message : "N/A");
         g_clear_error(&error);
-        return;
     }
-    pthread_mutex_lock(&frame_mutex);
-
-    g_queue_push_tail(delivered_frames, newBuffer);
-
-    VdoBuffer *oldBuffer = nullptr;
+}
 
-    // First check if there are any frames returned from app
-    // processing
-    if (g_queue_get_length(processed_frames) > 0)
-    {
-        oldBuffer = (VdoBuffer *)g_queue_pop_head(processed_frames);
-    }
-    else
-    {
-        // Client specifies the number-of-recent-frames it needs to collect
-        // in one chunk (numAppFrames). Thus only enqueue buffers back to
-        // VDO if we have collected more buffers than numAppFrames.
-        if (g_queue_get_length(delivered_frames) > num_app_frames)
-        {
-            oldBuffer = (VdoBuffer *)g_queue_pop_head(delivered_frames);
-        }
-    }
+/**
+ * brief Fetch the frame the stream has ready.
+ *
+ * Called by the FrameFetcher when the stream is readable. The ImgProvider
+ * always keeps the most recent frame available to the application, without
+ * locks and without allocating memory per frame:
+ * - latest_frame holds the newest frame delivered from VDO and not yet taken
+ *   by the client.
+ * - processed_frames is a ring of frames that the client has consumed and
+ *   handed back to the ImgProvider.
+ * Fetching works roughly like this:
+ * 1. The ready frame is taken from the non-blocking stream.
+ * 2. All frames in processed_frames are enqueued back to VDO.
+ * 3. The fresh frame replaces latest_frame. If the client did not take the
+ *    previous frame it is stale and enqueued back to VDO right away,
+ *    otherwise frame_ready is posted to wake up the client.
+ */
+void ImgProvider::FetchFrame()
+{
+    assert(initialized);
+    GError *error = nullptr;
+    VdoBuffer *newBuffer = vdo_stream_get_buffer(vdo_stream, &error);
 
-    if (oldBuffer)
+    if (!newBuffer)
     {
-        if (!vdo_stream_buffer_enqueue(vdo_stream, oldBuffer, &error))
+        // No frame after all is expected now and then on a non-blocking
+        // stream, anything else fails but we continue hoping for the best.
+        if (!vdo_error_is_expected(&error))
         {
-            // Fail but we continue anyway hoping for the best.
             syslog(
                 LOG_WARNING,
-                "%s: Failed enqueueing buffer to vdo: %s",
+                "%s: Failed fetching frame from vdo: %s",
                 __func__,
                 (error != nullptr) ? error->message : "N/A");
-            g_clear_error(&error);
         }
+        g_clear_error(&error);
+        return;
     }
-    g_object_unref(newBuffer); // Release the ref from vdo_stream_get_buffer
-    pthread_cond_signal(&frame_deliver_cond);
-    pthread_mutex_unlock(&frame_mutex);
-}
+    // VDO timestamps the frames with the monotonic clock at capture
+    Metrics::Record(StageCapture, vdo_frame_get_timestamp(vdo_buffer_get_frame(newBuffer)), Metrics::Now());
 
-/**
- * brief Starting point function for the thread fetching frames.
- *
- * Responsible for fetching buffers/frames from VDO and re-enqueue buffers back
- * to VDO when they are not needed by the application. The ImgProvider always
- * keeps one or several of the most recent frames available in the application.
- * There are two queues involved: delivered_frames and processed_frames.
- * - delivered_frames are frames delivered from VDO and
- *   not processed by the client.
- * - processed_frames are frames that the client has consumed and handed
- *   back to the ImgProvider.
- * The thread works roughly like this:
- * 1. The thread blocks on vdo_stream_get_buffer() until VDO deliver a new
- * frame.
- * 2. The fresh frame is put at the end of the deliveredFrame queue. If the
- *    client want to fetch a frame the item at the end of deliveredFrame
- *    list is returned.
- * 3. If there are any frames in the processed_frames list one of these are
- *    enqueued back to VDO to keep the flow of buffers.
- * 4. If the processed_frames list is empty we instead check if there are
- *    frames available in the delivered_frames list. We want to make sure
- *    there is at least numAppFrames buffers available to the client to
- *    fetch. If there are more than numAppFrames in delivered_frames we
- *    pick the first buffer (oldest) in the list and enqueue it to VDO.
-
- * param data Pointer to ImgProvider owning thread.
- * return Pointer to unused return data.
- */
-void *ImgProvider::threadEntry(void *data)
-{
-    assert(nullptr != data);
-    ImgProvider *provider = (ImgProvider *)data;
-    assert(provider->initialized);
+    // Hand back the frames the client is done with
+    VdoBuffer *processedBuffer = nullptr;
+    while (processed_frames.Pop(processedBuffer))
+    {
+        EnqueueBuffer(processedBuffer);
+    }
 
-    while (!provider->shutdown)
+    // Replace the latest frame. A frame the client never took is stale and
+    // goes straight back to VDO, otherwise the client is told there is a new
+    // frame.
+    VdoBuffer *staleBuffer = latest_frame.exchange(newBuffer);
+    if (nullptr != staleBuffer)
     {
-        provider->RunLoopIteration();
+        EnqueueBuffer(staleBuffer);
     }
-    return nullptr;
+    else
+    {
+        sem_post(&frame_ready);
+    }
+    g_object_unref(newBuffer); // Release the ref from vdo_stream_get_buffer
 }
 
 bool ImgProvider::StartFrameFetch(ImgProvider &provider)
 {
     assert(provider.initialized);
-    if (pthread_create(&provider.fetcher_thread, nullptr, provider.threadEntry, &provider))
+    if (!FrameFetcher::Add(provider))
     {
-        LOG_E("%s: Failed to start thread fetching frames from vdo: %s", __func__, strerror(errno));
+        LOG_E("%s: Failed to start fetching frames from vdo", __func__);
         return false;
     }
 
     return true;
 }
 
+/**
+ * brief Stop fetching frames and wake up any client waiting for a frame.
+ *
+ * Async-signal-safe. The frame fetcher lets go of the provider when it is
+ * destroyed.
+ *
+ * param provider Reference to an ImgProvider.
+ * return True.
+ */
 bool ImgProvider::StopFrameFetch(ImgProvider &provider)
 {
     provider.shutdown = true;
+    FrameFetcher::Wake();
+
+    // Wake up any client waiting for a frame
+    sem_post(&provider.frame_ready);
+
+    return true;
+}
 
-    if (pthread_join(provider.fetcher_thread, nullptr))
+/**
+ * brief Change the frame rate of the stream.
+ *
+ * Takes effect on a running stream, or on the stream once it is created.
+ *
+ * param provider Reference to an ImgProvider.
+ * param framerate Requested frame rate.
+ * return False if the frame rate could not be changed.
+ */
+bool ImgProvider::SetFramerate(ImgProvider &provider, const double framerate)
+{
+    provider.framerate = framerate;
+    if (nullptr == provider.vdo_stream)
     {
-        LOG_E("%s: Failed to join thread fetching frames from vdo: %s", __func__, strerror(errno));
-        return false;
+        return true;
     }
 
+    GError *error = nullptr;
+    if (!vdo_stream_set_framerate(provider.vdo_stream, framerate, &error))
+    {
+        LOG_E("%s: Failed to set frame rate: %s", __func__, (error != nullptr) ? error->message : "N/A");
+        g_clear_error(&error);
+        return false;
+    }
     return true;
 }
@@ -0,0 +1,211 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <syslog.h>
+
+#include "log.hpp"
+
+using namespace std;
+
+/**
+ * One message in the ring. The sequence number tells the producers and the
+ * consumer whose turn it is to use the slot, as in a bounded MPMC queue: it
+ * equals the position while free, the position + 1 once written.
+ */
+struct LogSlot
+{
+    atomic<size_t> sequence;
+    int priority;
+    char text[LOG_MESSAGE_SIZE];
+};
+
+static_assert(0 == (LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)), "LOG_RING_SLOTS must be a power of two");
+
+static LogSlot slots[LOG_RING_SLOTS];
+// Next position to write, claimed by the producers, and to read
+static atomic<size_t> tail(0);
+static size_t head = 0;
+static atomic<unsigned> dropped(0);
+static atomic<bool> running(false);
+// Calls of Log::Write() that may still put a message in the ring
+static atomic<unsigned> writers(0);
+static sem_t available;
+static pthread_t logthread;
+
+static void write_message(const int priority, const char *text)
+{
+    syslog(priority, "%s", text);
+    printf("%s\n", text);
+}
+
+/**
+ * brief Write the complete messages in the ring, in order, and the number of
+ * dropped ones. Only called by the one consumer of the ring.
+ */
+static void drain_ring()
+{
+    for (;;)
+    {
+        LogSlot &slot = slots[head & (LOG_RING_SLOTS - 1)];
+        if (slot.sequence.load(memory_order_acquire) != head + 1)
+        {
+            break;
+        }
+        write_message(slot.priority, slot.text);
+        slot.sequence.store(head + LOG_RING_SLOTS, memory_order_release);
+        head++;
+    }
+    const unsigned lost = dropped.exchange(0, memory_order_relaxed);
+    if (0 < lost)
+    {
+        char text[LOG_MESSAGE_SIZE];
+        snprintf(text, sizeof(text), "%s/%s: %u log messages dropped", __FILE__, __FUNCTION__, lost);
+        write_message(LOG_WARNING, text);
+    }
+}
+
+/**
+ * brief Start writing messages from a background thread.
+ *
+ * return true on success, otherwise messages are still written directly.
+ */
+bool Log::Start()
+{
+    assert(!running);
+
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++)
+    {
+        slots[i].sequence.store(i, memory_order_relaxed);
+    }
+    tail.store(0, memory_order_relaxed);
+    head = 0;
+    if (0 != sem_init(&available, 0, 0))
+    {
+        return false;
+    }
+    running = true;
+    if (0 != pthread_create(&logthread, nullptr, threadEntry, nullptr))
+    {
+        running = false;
+        sem_destroy(&available);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * brief Write the messages in the ring and go back to writing directly.
+ */
+void Log::Stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+    sem_post(&available);
+    pthread_join(logthread, nullptr);
+    // A message written while the thread stopped is still in the ring. New
+    // calls no longer use the ring, so only wait for those already in it.
+    while (0 != writers.load())
+    {
+        sched_yield();
+    }
+    drain_ring();
+    sem_destroy(&available);
+}
+
+/**
+ * brief Log a message, like syslog().
+ *
+ * Never blocks while the backend is started. Messages longer than
+ * LOG_MESSAGE_SIZE are truncated.
+ */
+void Log::Write(const int priority, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    // Sequentially consistent with Stop(), so either it waits for this call
+    // or this call sees the backend stopped
+    writers.fetch_add(1);
+    if (!running.load())
+    {
+        writers.fetch_sub(1, memory_order_release);
+        char text[LOG_MESSAGE_SIZE];
+        vsnprintf(text, sizeof(text), fmt, args);
+        va_end(args);
+        write_message(priority, text);
+        return;
+    }
+
+    // Claim the slot at the tail unless the consumer has yet to free it
+    size_t pos = tail.load(memory_order_relaxed);
+    LogSlot *slot;
+    for (;;)
+    {
+        slot = &slots[pos & (LOG_RING_SLOTS - 1)];
+        const intptr_t diff = (intptr_t)slot->sequence.load(memory_order_acquire) - (intptr_t)pos;
+        if (0 == diff)
+        {
+            if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (0 > diff)
+        {
+            va_end(args);
+            dropped.fetch_add(1, memory_order_relaxed);
+            writers.fetch_sub(1, memory_order_release);
+            return;
+        }
+        else
+        {
+            pos = tail.load(memory_order_relaxed);
+        }
+    }
+    slot->priority = priority;
+    vsnprintf(slot->text, sizeof(slot->text), fmt, args);
+    va_end(args);
+    slot->sequence.store(pos + 1, memory_order_release);
+    sem_post(&available);
+    writers.fetch_sub(1, memory_order_release);
+}
+
+void *Log::threadEntry(void *data)
+{
+    (void)data;
+
+    for (;;)
+    {
+        const bool stopping = !running.load(memory_order_acquire);
+        drain_ring();
+        if (stopping)
+        {
+            break;
+        }
+        while (0 != sem_wait(&available) && EINTR == errno)
+        {
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,145 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <time.h>
+
+#include "metrics.hpp"
+
+static LatencyHistogram histograms[StageCount];
+
+static const char *STAGE_NAMES[StageCount] =
+    {"Capture", "Wait", "Setup", "Averaging", "OpcUaWrite", "EventSend", "Shadow"};
+
+LatencyHistogram::LatencyHistogram() : count(0), max(0)
+{
+    for (size_t i = 0; i < METRIC_BUCKETS; i++)
+    {
+        buckets[i] = 0;
+    }
+}
+
+void LatencyHistogram::Record(const uint64_t duration_us)
+{
+    buckets[BucketIndex(duration_us)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (current < duration_us && !max.compare_exchange_weak(current, duration_us, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t LatencyHistogram::Count() const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Max() const
+{
+    return max.load(std::memory_order_relaxed);
+}
+
+/**
+ * brief Get an upper bound of a percentile of the recorded durations.
+ *
+ * param percentile The percentile, 0-100.
+ * return The upper bound of the bucket holding the percentile in us, or 0 if
+ *        nothing has been recorded.
+ */
+uint64_t LatencyHistogram::Percentile(const double percentile) const
+{
+    assert(0.0 <= percentile && 100.0 >= percentile);
+    uint32_t snapshot[METRIC_BUCKETS];
+    uint64_t total = 0;
+    for (size_t i = 0; i < METRIC_BUCKETS; i++)
+    {
+        snapshot[i] = buckets[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+    if (0 == total)
+    {
+        return 0;
+    }
+
+    const uint64_t rank = (uint64_t)(percentile / 100.0 * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < METRIC_BUCKETS; i++)
+    {
+        seen += snapshot[i];
+        if (seen >= rank)
+        {
+            const uint64_t bound = BucketUpperBound(i);
+            return bound < Max() ? bound : Max();
+        }
+    }
+    return Max();
+}
+
+size_t LatencyHistogram::BucketIndex(const uint64_t duration_us)
+{
+    if (4 > duration_us)
+    {
+        return duration_us;
+    }
+    const size_t msb = 63 - __builtin_clzll(duration_us);
+    const size_t index = (msb - 1) * 4 + ((duration_us >> (msb - 2)) & 3);
+    return index < METRIC_BUCKETS ? index : METRIC_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(const size_t index)
+{
+    if (4 > index)
+    {
+        return index;
+    }
+    const size_t shift = index / 4 - 1;
+    return ((uint64_t)(4 + index % 4 + 1) << shift) - 1;
+}
+
+/**
+ * brief Record the duration of a stage.
+ *
+ * param stage The stage.
+ * param start_us Start of the stage, monotonic time in us.
+ * param end_us End of the stage, monotonic time in us.
+ */
+void Metrics::Record(const MetricStage stage, const int64_t start_us, const int64_t end_us)
+{
+    assert(StageCount > stage);
+    histograms[stage].Record(end_us > start_us ? end_us - start_us : 0);
+}
+
+const LatencyHistogram &Metrics::Histogram(const MetricStage stage)
+{
+    assert(StageCount > stage);
+    return histograms[stage];
+}
+
+const char *Metrics::StageName(const MetricStage stage)
+{
+    assert(StageCount > stage);
+    return STAGE_NAMES[stage];
+}
+
+/**
+ * brief Get the monotonic time in us, same clock as VDO frame timestamps.
+ */
+int64_t Metrics::Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
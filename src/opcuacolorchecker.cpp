@@ -14,37 +14,85 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <atomic>
 #include <axhttp.h>
 #include <axparameter.h>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/video.hpp>
 #include <stdexcept>
 #include <string>
 #include <syslog.h>
+#include <thread>
 
+#include "analysisresult.hpp"
 #include "colorarea.hpp"
 #include "common.hpp"
+#include "cropdump.hpp"
 #include "evhandler.hpp"
+#include "framehandle.hpp"
 #include "imgprovider.hpp"
+#include "metrics.hpp"
 #include "opcuaserver.hpp"
+#include "regionset.hpp"
+#include "snapshot.hpp"
+#include "spscring.hpp"
+#include "statefilter.hpp"
+#include "taskpool.hpp"
 
 using namespace cv;
 using namespace std;
 
-enum MarkerShape
+// Maximum time to wait for the analysis thread to pick the current color,
+// on top of the time of the frames to average
+#define PICK_TIMEOUT_MS (2000)
+// Most frames pickcurrent.cgi can average the color over
+#define PICK_MAX_FRAMES (100)
+// Time to stay at full frame rate after a change in adaptive mode
+#define ADAPTIVE_HOLD_MS (2000)
+// Change of a color channel between two evaluations that counts as a change
+#define ADAPTIVE_COLOR_DELTA (10.0)
+// Longest time the analysis thread sleeps at a time in adaptive mode
+#define ADAPTIVE_SLEEP_MS (50)
+// Smallest marker width/height in stream pixels with automatic resolution
+#define MIN_MARKER_DETAIL (16)
+// Poll interval while the analysis waits for room in a publishing queue
+#define QUEUE_WAIT_MS (1)
+// Longest time a getstatus.cgi request waits for a newer result
+#define STATUS_WAIT_TIMEOUT_MS (20000)
+// Interval for checking waiting getstatus.cgi requests against the result
+#define STATUS_CHECK_MS (50)
+// Most getstatus.cgi requests waiting at once, others are answered directly
+#define MAX_STATUS_REQUESTS (32)
+// Crop dump of a channel, in memory so that it does not wear the flash
+#define CROP_DUMP_PATH "/tmp/opcuacolorchecker-crops-%u.bin"
+
+enum AnalysisResolution
 {
-    Ellipse = 0,
-    Rectangle,
-    MarkerCount
+    ResolutionFull = 0,
+    ResolutionAuto,
+    ResolutionCount
 };
 
-static atomic<bool> pickcurrent(false);
-static atomic<bool> currentstate(false);
+// Number of frames to average for a requested pick, taken by the analysis thread
+static atomic<uint32_t> pickframes(0);
+// Incremented per pick, so a pick that timed out is not used
+static atomic<uint32_t> pickgeneration(0);
+static mutex pickmtx;
+static Scalar pickedcolor;
+// pickcurrent.cgi requests waiting for the pick, only used in the main loop
+static vector<GOutputStream *> pickrequests;
+static guint picktimer = 0;
 
 static GMainLoop *loop = nullptr;
 
+// Protects the color area parameters, never taken by the analysis thread
 static mutex mtx;
 
 static AxEventHandler evhandler;
@@ -55,11 +103,152 @@ static uint32_t markerwidth;
 static uint32_t markerheight;
 static uint8_t markershape;
 static uint8_t tolerance;
-static ColorArea *colorarea = nullptr;
+static string regions;
+static uint8_t analysisresolution;
+static uint8_t colormetric;
+static uint32_t smoothingframes;
+static uint32_t hysteresis;
+static uint32_t mindwell_ms;
+static string shadowregions;
+// Resolution that the color area coordinates are given in
+static Size configsize;
+
+/// Target of the first color area and the filter settings of all color areas,
+/// which can change without a rebuild
+struct RegionTarget
+{
+    double color[3];
+    uint8_t tolerance;
+    ColorMetricType metric;
+    FilterConfig filter;
+};
+static Snapshot<RegionTarget> regiontarget;
+
+/// Buffers of the analysis thread, set up with the stream so that analyzing a
+/// frame allocates no heap memory
+struct AnalysisScratch
+{
+    vector<RegionResult> results;
+    vector<RegionResult> shadowresults;
+    /// Copy of the result being handed to the OPC UA and event stages
+    AnalysisResult published;
+#if defined(DEBUG_WRITE)
+    Mat bgr;
+#endif
+};
+
+/// Color areas of one channel, and where their readings go in the result
+struct ChannelRegions
+{
+    shared_ptr<RegionSet> regionset;
+    /// Index in the result of each color area of the region set
+    vector<size_t> indices;
+    /// Number of color areas over all channels
+    uint32_t numcolorareas;
+    /// Holds the first color area, which the target and the pick are for
+    bool primary;
+    /// The color areas as given to the region set, in the stream resolution
+    vector<RegionSpec> specs;
+};
+
+/// Stream and analysis of one VDO channel, analyzed in a thread of its own
+struct ChannelAnalysis
+{
+    unsigned int channel = 0;
+    ImgProvider *provider = nullptr;
+    thread *worker = nullptr;
+    /// Resolution of the analyzed stream, empty until the stream is set up
+    Size analysissize;
+    /// Color areas with new geometry, built off the analysis thread and
+    /// swapped in by it at the next frame
+    shared_ptr<ChannelRegions> pending;
+    /// Candidate color areas to evaluate next to the live ones, handed over
+    /// like the pending ones; an empty region set ends the shadow evaluation
+    shared_ptr<ChannelRegions> pendingshadow;
+    // The rest is only touched by the analysis thread of the channel
+    shared_ptr<ChannelRegions> regions;
+    shared_ptr<ChannelRegions> shadow;
+    /// Index in regions of the live color area each shadow color area is
+    /// compared with, -1 for none
+    int shadowpeers[MAX_REGIONS];
+    uint32_t targetversion = 0;
+    ColorMetricType metric = MetricChannel;
+    CropDump cropdump;
+    /// Frames asked for when the crop dump was last opened
+    uint32_t dumpframes = 0;
+    int64_t lastevaluation = 0;
+    StateFilter filters[MAX_REGIONS];
+    AnalysisScratch scratch;
+    // Pick being averaged, 0 frames when there is none
+    uint32_t picktarget = 0;
+    uint32_t pickcount = 0;
+    uint32_t pickid = 0;
+    Scalar picksum;
+};
+// Channels analyzed, set up at start from the channels of the color areas.
+// The first one is DEFAULT_CHANNEL, which holds the first color area.
+static ChannelAnalysis channelanalyses[MAX_CHANNELS];
+static size_t numchannels = 0;
+// Latest readings of the color areas of all channels, each analysis thread
+// updates its own color areas and publishes the result under resultmtx
+static mutex resultmtx;
+static AnalysisResult channelresult;
+// The analysis threads hand their results to the OPC UA and event queues in
+// turns, in frame order, without holding resultmtx while a queue is full
+static mutex publishmtx;
+static condition_variable publishturn;
+static uint64_t nextpublished = 1;
+static AnalysisSnapshot analysisresults;
 static OpcUaServer opcuaserver;
+// Threads evaluating the color areas of a frame, shared by all channels
+static TaskPool *taskpool = nullptr;
+
+static atomic<bool> analysisrunning(false);
+static double framerate = 30.0;
+// Evaluation rate while nothing changes, 0 to always run at full frame rate
+static atomic<double> idleframerate(0.0);
+// Monotonic time in us until which every frame is evaluated
+static atomic<int64_t> fullrateuntil(0);
+// Frames kept in the crop dump of each channel, 0 for no dump
+static atomic<uint32_t> cropdumpframes(0);
+
+/// How a shadow color area compares with the live one of the same index
+struct ShadowStats
+{
+    atomic<uint64_t> frames{0};
+    atomic<uint64_t> agreed{0};
+    atomic<uint64_t> shadowwithin{0};
+    atomic<uint64_t> livewithin{0};
+};
+// Counted by the analysis thread of the channel of each shadow color area
+static ShadowStats shadowstats[MAX_REGIONS];
+static atomic<uint32_t> numshadowareas(0);
 
-static ImgProvider *provider = nullptr;
-static Mat nv12_mat;
+/// States of all color areas of a frame where some state changed
+struct EventStates
+{
+    uint32_t numcolorareas;
+    bool withintolerance[MAX_REGIONS];
+};
+// Every state change in order, from the analysis thread to the main loop
+static SpscRing<EventStates, RESULT_QUEUE_SIZE> eventqueue;
+static atomic<bool> eventdispatchpending(false);
+// Event states as last sent from the main loop
+static size_t numeventareas = 0;
+static bool eventstates[MAX_REGIONS];
+
+/// A getstatus.cgi request waiting for a newer result, only used in the main loop
+struct StatusRequest
+{
+    GOutputStream *stream;
+    /// Wait for a new frame rather than for a state change
+    bool waitframe;
+    /// Frame or state change counter the client already has
+    uint64_t known;
+    int64_t deadline;
+};
+static vector<StatusRequest> statusrequests;
+static guint statustimer = 0;
 
 static gboolean set_param(AXParameter &axparameter, const gchar *name, const gchar &value, gboolean do_sync = TRUE)
 {
@@ -107,366 +296,1081 @@ static gchar *get_param(AXParameter &axparameter, const gchar *name)
     return value;
 }
 
-static gboolean get_param_double(AXParameter &axparameter, const gchar *name, double &val)
+static void get_region_specs(vector<RegionSpec> &specs)
+{
+    // The first color area is the one set up through the individual
+    // parameters, additional ones come from the Regions parameter
+    specs.resize(1);
+    specs[0].center = center_point;
+    specs[0].color = color;
+    specs[0].markerwidth = markerwidth;
+    specs[0].markerheight = markerheight;
+    specs[0].markershape = markershape;
+    specs[0].tolerance = tolerance;
+    specs[0].channel = DEFAULT_CHANNEL;
+    if (!RegionSet::ParseRegions(regions, configsize, specs))
+    {
+        LOG_E("%s/%s: Ignoring invalid Regions parameter", __FILE__, __FUNCTION__);
+    }
+}
+
+/**
+ * brief Get the smallest scale of the config resolution that gives all
+ * markers at least MIN_MARKER_DETAIL pixels in width and height.
+ */
+static double get_required_scale(void)
+{
+    vector<RegionSpec> specs;
+    get_region_specs(specs);
+    uint32_t smallest = UINT32_MAX;
+    for (auto &spec : specs)
+    {
+        smallest = min(smallest, min(spec.markerwidth, spec.markerheight));
+    }
+    return min(1.0, (double)MIN_MARKER_DETAIL / smallest);
+}
+
+/**
+ * brief Build the color areas of one channel.
+ *
+ * param analysis Channel with its stream set up.
+ * param specs Color areas of all channels, in the config resolution.
+ * return The color areas of the channel, in the stream resolution.
+ */
+static ChannelRegions *create_channel_regions(const ChannelAnalysis &analysis, const vector<RegionSpec> &specs)
 {
-    auto valuestr = get_param(axparameter, name);
+    const Size &img_size = analysis.analysissize;
+    ChannelRegions *regions = new ChannelRegions;
+    regions->numcolorareas = specs.size();
+    vector<RegionSpec> channelspecs;
+    for (size_t i = 0; i < specs.size(); i++)
+    {
+        if (analysis.channel == specs[i].channel)
+        {
+            channelspecs.push_back(specs[i]);
+            regions->indices.push_back(i);
+        }
+    }
+    regions->primary = !regions->indices.empty() && 0 == regions->indices[0];
+
+    // Map the color areas from the config resolution to the stream
+    assert(0 < configsize.width && 0 < configsize.height);
+    if (img_size != configsize)
+    {
+        const double scalex = (double)img_size.width / configsize.width;
+        const double scaley = (double)img_size.height / configsize.height;
+        for (auto &spec : channelspecs)
+        {
+            spec.center.x = cvRound(spec.center.x * scalex);
+            spec.center.y = cvRound(spec.center.y * scaley);
+            spec.markerwidth = max(1, cvRound(spec.markerwidth * scalex));
+            spec.markerheight = max(1, cvRound(spec.markerheight * scaley));
+        }
+        if (get_required_scale() > min(scalex, scaley))
+        {
+            LOG_I(
+                "%s/%s: Some marker is smaller than %d pixels in the %dx%d stream, restart to pick a larger stream",
+                __FILE__,
+                __FUNCTION__,
+                MIN_MARKER_DETAIL,
+                img_size.width,
+                img_size.height);
+        }
+    }
+
+    regions->regionset.reset(new RegionSet(img_size, channelspecs));
+    regions->specs = channelspecs;
+    return regions;
+}
+
+/**
+ * brief Build color areas for the current parameters.
+ *
+ * Runs in the thread changing the parameters, so the analysis threads only
+ * have to swap in the new color areas. Must be called with mtx held.
+ */
+static void rebuild_regionset(void)
+{
+    fullrateuntil = Metrics::Now() + ADAPTIVE_HOLD_MS * 1000;
+    if (0 == numchannels || 0 == channelanalyses[0].analysissize.area())
+    {
+        // The streams are not set up yet
+        return;
+    }
+    LOG_I("%s/%s: Set up new color areas", __FILE__, __FUNCTION__);
+    vector<RegionSpec> specs;
+    get_region_specs(specs);
+    for (size_t i = 0; i < specs.size(); i++)
+    {
+        size_t c = 0;
+        while (c < numchannels && channelanalyses[c].channel != specs[i].channel)
+        {
+            c++;
+        }
+        if (numchannels == c)
+        {
+            LOG_I(
+                "%s/%s: Color area %zu is on channel %u, which is not analyzed, restart to analyze it",
+                __FILE__,
+                __FUNCTION__,
+                i,
+                specs[i].channel);
+        }
+    }
+    for (size_t c = 0; c < numchannels; c++)
+    {
+        shared_ptr<ChannelRegions> regions(create_channel_regions(channelanalyses[c], specs));
+        atomic_store(&channelanalyses[c].pending, regions);
+    }
+}
+
+/**
+ * brief Build the shadow color areas for the current ShadowRegions.
+ *
+ * Like rebuild_regionset(), but the color areas are only compared with the
+ * live ones and never published. Must be called with mtx held.
+ */
+static void rebuild_shadow(void)
+{
+    if (0 == numchannels || 0 == channelanalyses[0].analysissize.area())
+    {
+        // The streams are not set up yet
+        return;
+    }
+    vector<RegionSpec> specs;
+    if (!RegionSet::ParseRegions(shadowregions, configsize, specs))
+    {
+        LOG_E("%s/%s: Ignoring invalid ShadowRegions parameter", __FILE__, __FUNCTION__);
+        specs.clear();
+    }
+    LOG_I("%s/%s: Set up %zu shadow color areas", __FILE__, __FUNCTION__, specs.size());
+    numshadowareas = specs.size();
+    for (size_t c = 0; c < numchannels; c++)
+    {
+        shared_ptr<ChannelRegions> shadow(create_channel_regions(channelanalyses[c], specs));
+        atomic_store(&channelanalyses[c].pendingshadow, shadow);
+    }
+}
+
+/**
+ * brief Publish a new target and filter settings for the color areas.
+ *
+ * Must be called with mtx held.
+ */
+static void update_target(void)
+{
+    fullrateuntil = Metrics::Now() + ADAPTIVE_HOLD_MS * 1000;
+    RegionTarget target;
+    target.color[B] = color.val[B];
+    target.color[G] = color.val[G];
+    target.color[R] = color.val[R];
+    target.tolerance = tolerance;
+    target.metric = static_cast<ColorMetricType>(colormetric);
+    target.filter.smoothingframes = smoothingframes;
+    target.filter.hysteresis = hysteresis;
+    target.filter.mindwell_ms = mindwell_ms;
+    regiontarget.Publish(target);
+}
+
+/**
+ * brief Convert a parameter value string to the type of the setting.
+ */
+template <typename T> static T parse_value(const gchar *value);
+
+template <> uint32_t parse_value<uint32_t>(const gchar *value)
+{
+    return atoi(value);
+}
+
+template <> double parse_value<double>(const gchar *value)
+{
+    return atof(value);
+}
+
+/**
+ * brief Setter for a plain setting with no side effects of its own.
+ */
+template <typename T, typename V, V *setting> static void set_value(const gchar *value)
+{
+    *setting = parse_value<T>(value);
+}
+
+/**
+ * brief Setter for one channel of the target color.
+ */
+template <int channel> static void set_color(const gchar *value)
+{
+    color.val[channel] = parse_value<double>(value);
+}
+
+static void set_port(const gchar *value)
+{
+    if (opcuaserver.IsRunning())
+    {
+        opcuaserver.ShutDownServer();
+    }
+    if (!opcuaserver.LaunchServer(parse_value<uint32_t>(value)))
+    {
+        const char *msg = "Failed to launch OPC UA server";
+        LOG_E("%s/%s: %s", __FILE__, __FUNCTION__, msg);
+        throw runtime_error(msg);
+    }
+}
+
+static void set_framerate(const gchar *value)
+{
+    framerate = parse_value<uint32_t>(value);
+    for (size_t c = 0; c < numchannels; c++)
+    {
+        ImgProvider *provider = channelanalyses[c].provider;
+        if (nullptr != provider && !ImgProvider::SetFramerate(*provider, framerate))
+        {
+            LOG_E(
+                "%s/%s: Failed to change frame rate of channel %u to %s",
+                __FILE__,
+                __FUNCTION__,
+                provider->Channel(),
+                value);
+        }
+    }
+}
+
+static void set_idleframerate(const gchar *value)
+{
+    idleframerate = parse_value<double>(value);
+    fullrateuntil = Metrics::Now() + ADAPTIVE_HOLD_MS * 1000;
+}
+
+static void set_heartbeatinterval(const gchar *value)
+{
+    opcuaserver.SetHeartbeatInterval(parse_value<uint32_t>(value));
+}
+
+static void set_eventinterval(const gchar *value)
+{
+    evhandler.SetInterval(parse_value<uint32_t>(value));
+}
+
+static void set_maxworkerthreads(const gchar *value)
+{
+    assert(nullptr != taskpool);
+    taskpool->SetMaxThreads(parse_value<uint32_t>(value));
+}
+
+static void set_analysisresolution(const gchar *value)
+{
+    // Only read when the stream is set up
+    const uint32_t val = parse_value<uint32_t>(value);
+    assert(ResolutionCount > val);
+    analysisresolution = val;
+}
+
+static void set_colormetric(const gchar *value)
+{
+    const uint32_t val = parse_value<uint32_t>(value);
+    assert(MetricTypeCount > val);
+    colormetric = val;
+}
+
+static void set_center_x(const gchar *value)
+{
+    center_point.x = parse_value<uint32_t>(value);
+}
+
+static void set_center_y(const gchar *value)
+{
+    center_point.y = parse_value<uint32_t>(value);
+}
+
+static void set_markershape(const gchar *value)
+{
+    const uint32_t val = parse_value<uint32_t>(value);
+    assert(MarkerCount > val);
+    markershape = val;
+}
+
+static void set_regions(const gchar *value)
+{
+    regions = value;
+}
+
+static void set_shadowregions(const gchar *value)
+{
+    shadowregions = value;
+}
+
+static void set_cropdumpframes(const gchar *value)
+{
+    // Taken up by the analysis threads at their next frame
+    cropdumpframes = parse_value<uint32_t>(value);
+}
+
+static void set_nothing(const gchar *value)
+{
+    // Not to be set by the user but only read by the config UI
+    (void)value;
+}
+
+// What has to be redone in the color checker after a parameter is changed
+enum ParamEffect
+{
+    EffectNone = 0,
+    EffectTarget = 1 << 0,
+    EffectGeometry = 1 << 1,
+    EffectShadow = 1 << 2
+};
+
+struct ParamConfig
+{
+    const gchar *name;
+    ParamEffect effect;
+    void (*setter)(const gchar *value);
+};
+
+// All parameters handled by the application. Port comes first so the OPC UA
+// server is launched as early as possible. Setters of parameters with an
+// effect are called with mtx held, the others without.
+static const ParamConfig PARAMS[] = {
+    {"Port", EffectNone, set_port},
+    {"AnalysisResolution", EffectNone, set_analysisresolution},
+    {"CenterX", EffectGeometry, set_center_x},
+    {"CenterY", EffectGeometry, set_center_y},
+    {"ColorB", EffectTarget, set_color<B>},
+    {"ColorG", EffectTarget, set_color<G>},
+    {"ColorMetric", EffectTarget, set_colormetric},
+    {"ColorR", EffectTarget, set_color<R>},
+    {"CropDumpFrames", EffectNone, set_cropdumpframes},
+    {"EventInterval", EffectNone, set_eventinterval},
+    {"FrameRate", EffectNone, set_framerate},
+    {"HeartbeatInterval", EffectNone, set_heartbeatinterval},
+    {"Height", EffectNone, set_nothing},
+    {"Hysteresis", EffectTarget, set_value<uint32_t, uint32_t, &hysteresis>},
+    {"IdleFrameRate", EffectNone, set_idleframerate},
+    {"MarkerHeight", EffectGeometry, set_value<uint32_t, uint32_t, &markerheight>},
+    {"MarkerShape", EffectGeometry, set_markershape},
+    {"MarkerWidth", EffectGeometry, set_value<uint32_t, uint32_t, &markerwidth>},
+    {"MaxWorkerThreads", EffectNone, set_maxworkerthreads},
+    {"MinDwellTime", EffectTarget, set_value<uint32_t, uint32_t, &mindwell_ms>},
+    {"Regions", EffectGeometry, set_regions},
+    {"ShadowRegions", EffectShadow, set_shadowregions},
+    {"SmoothingFrames", EffectTarget, set_value<uint32_t, uint32_t, &smoothingframes>},
+    {"Tolerance", EffectTarget, set_value<uint32_t, uint8_t, &tolerance>},
+    {"Width", EffectNone, set_nothing},
+};
+
+// Effects of changed parameters not yet applied, only used in the main loop
+static unsigned int pendingeffects = EffectNone;
+
+/**
+ * brief Apply the effects of all parameters changed since the last call.
+ *
+ * Scheduled as an idle source, so it runs after all parameter callbacks
+ * dispatched in the same main loop iteration. A batch of changes, e.g. from
+ * one param.cgi update, thereby costs one recalibration.
+ */
+static gboolean apply_param_effects(gpointer data)
+{
+    (void)data;
+    mtx.lock();
+    if (0 != (pendingeffects & EffectGeometry))
+    {
+        rebuild_regionset();
+    }
+    if (0 != (pendingeffects & EffectTarget))
+    {
+        update_target();
+    }
+    if (0 != (pendingeffects & EffectShadow))
+    {
+        rebuild_shadow();
+    }
+    pendingeffects = EffectNone;
+    mtx.unlock();
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * brief Set a parameter and schedule its effects.
+ *
+ * param param The parameter.
+ * param value The new value.
+ */
+static void update_local_param(const ParamConfig &param, const gchar *value)
+{
+    if (EffectNone == param.effect)
+    {
+        param.setter(value);
+        return;
+    }
+
+    mtx.lock();
+    param.setter(value);
+    mtx.unlock();
+
+    if (EffectNone == pendingeffects)
+    {
+        g_idle_add(apply_param_effects, nullptr);
+    }
+    pendingeffects |= param.effect;
+}
+
+/**
+ * brief Callback for changes of any parameter.
+ *
+ * The user data is the parameter's table entry, so no name lookup is needed.
+ */
+static void param_callback(const gchar *name, const gchar *value, void *data)
+{
+    assert(nullptr != name);
+    assert(nullptr != value);
+    assert(nullptr != data);
+    if (nullptr == value)
+    {
+        LOG_E("%s/%s: Unexpected nullptr value for %s", __FILE__, __FUNCTION__, name);
+        return;
+    }
+
+    LOG_I("Update for parameter %s (%s)", name, value);
+    update_local_param(*static_cast<const ParamConfig *>(data), value);
+}
+
+/**
+ * brief Get the initial value of a parameter and act on it.
+ *
+ * Effects are not applied, the color areas are set up once all parameters
+ * are loaded and the stream is known.
+ *
+ * param axparameter The parameter handle.
+ * param param The parameter.
+ * return TRUE on success.
+ */
+static gboolean load_param(AXParameter &axparameter, const ParamConfig &param)
+{
+    auto valuestr = get_param(axparameter, param.name);
     if (nullptr == valuestr)
     {
+        LOG_E("%s/%s: Failed to get initial value for %s", __FILE__, __FUNCTION__, param.name);
         return FALSE;
     }
-    val = atof(valuestr);
+    param.setter(valuestr);
     g_free(valuestr);
+
     return TRUE;
 }
 
-static gboolean get_param_int(AXParameter &axparameter, const gchar *name, int &val)
+static gboolean register_param(AXParameter &axparameter, const ParamConfig &param)
 {
-    auto valuestr = get_param(axparameter, name);
-    if (nullptr == valuestr)
+    GError *error = nullptr;
+    gpointer userdata = const_cast<ParamConfig *>(&param);
+    if (!ax_parameter_register_callback(&axparameter, param.name, param_callback, userdata, &error))
     {
+        LOG_E("%s/%s: failed to register %s callback", __FILE__, __FUNCTION__, param.name);
+        if (nullptr != error)
+        {
+            LOG_E("%s/%s: %s", __FILE__, __FUNCTION__, error->message);
+            g_error_free(error);
+        }
         return FALSE;
     }
-    val = atoi(valuestr);
-    g_free(valuestr);
+
     return TRUE;
 }
 
-static void purge_colorarea(void)
+/**
+ * brief Get the initial values of all parameters.
+ *
+ * axparameter has no call to get a whole group, so the values are fetched one
+ * by one, but without registering callbacks in between.
+ */
+static gboolean load_params(AXParameter &axparameter)
 {
-    // Recalibrate color checker at next frame
-    if (nullptr != colorarea)
+    for (auto &param : PARAMS)
     {
-        delete colorarea;
-        colorarea = nullptr;
+        if (!load_param(axparameter, param))
+        {
+            return FALSE;
+        }
     }
+    LOG_I("%s/%s: Loaded %zu parameters", __FILE__, __FUNCTION__, sizeof(PARAMS) / sizeof(PARAMS[0]));
+    return TRUE;
 }
 
-static void update_local_param_double(const gchar &name, const double val)
+/**
+ * brief Register callbacks for changes of all parameters.
+ *
+ * The callbacks are called from the main loop, so they do not run before it
+ * is started.
+ */
+static gboolean register_params(AXParameter &axparameter)
 {
-    mtx.lock();
-    if (0 == strcmp("ColorR", &name))
+    for (auto &param : PARAMS)
+    {
+        if (!register_param(axparameter, param))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * brief Send events for color areas whose state has changed.
+ *
+ * Runs in the main loop, where the event handler lives, and hands the queued
+ * state changes over in order, so a state that flips back before the main
+ * loop gets to run still results in two events, unless the event handler
+ * coalesces them by its interval.
+ */
+static gboolean dispatch_events(gpointer data)
+{
+    (void)data;
+    eventdispatchpending = false;
+
+    EventStates states;
+    const int64_t start = Metrics::Now();
+    bool sent = false;
+    while (eventqueue.Pop(states))
     {
-        color.val[R] = val;
+        if (states.numcolorareas != numeventareas)
+        {
+            evhandler.SetNumColorAreas(states.numcolorareas);
+            for (size_t i = numeventareas; i < states.numcolorareas; i++)
+            {
+                eventstates[i] = false;
+            }
+            numeventareas = states.numcolorareas;
+        }
+        for (size_t i = 0; i < numeventareas; i++)
+        {
+            const bool newstate = states.withintolerance[i];
+            if (newstate != eventstates[i])
+            {
+                // Trigger Axis event for state change
+                evhandler.Send(i, newstate);
+                eventstates[i] = newstate;
+                sent = true;
+            }
+        }
     }
-    else if (0 == strcmp("ColorG", &name))
+    if (sent)
     {
-        color.val[G] = val;
+        Metrics::Record(StageEventSend, start, Metrics::Now());
     }
-    else if (0 == strcmp("ColorB", &name))
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * brief Queue the states of a result for the events.
+ *
+ * Waits for the main loop while the queue is full rather than dropping a
+ * state change. Meanwhile the image provider drops the stale frames.
+ *
+ * param result Result with a changed state.
+ */
+static void queue_event_states(const AnalysisResult &result)
+{
+    EventStates states;
+    states.numcolorareas = result.numcolorareas;
+    for (size_t i = 0; i < result.numcolorareas; i++)
     {
-        color.val[B] = val;
+        states.withintolerance[i] = result.colorareas[i].withintolerance;
     }
-    else
+    while (!eventqueue.Push(states))
     {
-        LOG_E("%s/%s: FAILED to act on param %s", __FILE__, __FUNCTION__, &name);
-        throw runtime_error("Unknown double parameter.");
+        if (!analysisrunning)
+        {
+            return;
+        }
+        this_thread::sleep_for(chrono::milliseconds(QUEUE_WAIT_MS));
     }
+    if (!eventdispatchpending.exchange(true))
+    {
+        g_idle_add(dispatch_events, nullptr);
+    }
+}
 
-    purge_colorarea();
-    mtx.unlock();
+static gboolean complete_pick(gpointer data);
+
+/**
+ * brief Pair each shadow color area with the live color area of its index.
+ */
+static void pair_shadow(ChannelAnalysis &analysis)
+{
+    const vector<size_t> &shadow = analysis.shadow->indices;
+    const vector<size_t> &live = analysis.regions->indices;
+    for (size_t i = 0; i < shadow.size(); i++)
+    {
+        const auto peer = lower_bound(live.begin(), live.end(), shadow[i]);
+        analysis.shadowpeers[i] = (live.end() != peer && *peer == shadow[i]) ? peer - live.begin() : -1;
+    }
+}
+
+/**
+ * brief Evaluate the shadow color areas on the frame of the live ones.
+ *
+ * param analysis The channel, with shadow color areas.
+ * param nv12_img The frame the live color areas were evaluated on.
+ * param states CropDumpState bits of the live color areas in the frame.
+ */
+static void evaluate_shadow(ChannelAnalysis &analysis, const Mat &nv12_img, const uint8_t *states)
+{
+    const int64_t start = Metrics::Now();
+    const ChannelRegions &shadow = *analysis.shadow;
+    vector<RegionResult> &results = analysis.scratch.shadowresults;
+    shadow.regionset->Evaluate(nv12_img, results, taskpool);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const int peer = analysis.shadowpeers[i];
+        if (0 > peer)
+        {
+            continue;
+        }
+        // Compared before smoothing, which applies the same to both
+        const bool livewithin = 0 != (states[peer] & StateWithin);
+        ShadowStats &stats = shadowstats[shadow.indices[i]];
+        stats.frames.fetch_add(1, memory_order_relaxed);
+        stats.agreed.fetch_add(livewithin == results[i].withintolerance, memory_order_relaxed);
+        stats.shadowwithin.fetch_add(results[i].withintolerance, memory_order_relaxed);
+        stats.livewithin.fetch_add(livewithin, memory_order_relaxed);
+    }
+    Metrics::Record(StageShadow, start, Metrics::Now());
+}
+
+/**
+ * brief Start the crop dump of a channel over for its current color areas.
+ *
+ * param analysis The channel.
+ * param frames Frames to keep, 0 to stop dumping.
+ */
+static void reopen_crop_dump(ChannelAnalysis &analysis, const uint32_t frames)
+{
+    analysis.cropdump.Close();
+    analysis.dumpframes = frames;
+    if (0 < frames)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), CROP_DUMP_PATH, analysis.channel);
+        const ChannelRegions &regions = *analysis.regions;
+        analysis.cropdump.Open(path, analysis.analysissize, *regions.regionset, regions.specs, analysis.metric, frames);
+    }
 }
 
-static void update_local_param_int(const gchar &name, const uint32_t val)
+/**
+ * brief Analyze the latest frame of one channel.
+ *
+ * param analysis The channel, only analyzed by this thread.
+ * return False when there are no more frames.
+ */
+static bool imageanalysis(ChannelAnalysis &analysis)
 {
-    // Parameters that do not change the color checker go here
-    if (0 == strncmp("Port", &name, 4))
+    // In adaptive mode, evaluate at the idle frame rate while nothing changes
+    const double idlerate = idleframerate;
+    if (0.0 < idlerate && 0 == analysis.picktarget && 0 == pickframes)
     {
-        if (opcuaserver.IsRunning())
+        const int64_t now = Metrics::Now();
+        const int64_t due = analysis.lastevaluation + (int64_t)(1000000.0 / idlerate);
+        if (now >= fullrateuntil && now < due)
         {
-            opcuaserver.ShutDownServer();
+            // Sleep in short steps to stay responsive to changes and shutdown
+            this_thread::sleep_for(chrono::microseconds(min<int64_t>(due - now, ADAPTIVE_SLEEP_MS * 1000)));
+            return true;
         }
-        if (!opcuaserver.LaunchServer(val))
+    }
+
+    // Get the latest NV12 image frame from VDO using the imageprovider
+    assert(nullptr != analysis.provider);
+    FrameHandle frame = FrameHandle::Acquire(*analysis.provider);
+    if (!frame.Valid())
+    {
+        if (analysis.provider->shutdown)
         {
-            const char *msg = "Failed to launch OPC UA server";
-            LOG_E("%s/%s: %s", __FILE__, __FUNCTION__, msg);
-            throw runtime_error(msg);
+            LOG_I("%s/%s: No more frames available on channel %u, exiting", __FILE__, __FUNCTION__, analysis.channel);
+            return false;
         }
-        return;
+        LOG_E("%s/%s: No frame received in time on channel %u", __FILE__, __FUNCTION__, analysis.channel);
+        return true;
     }
-    if (0 == strncmp("Width", &name, 5) || 0 == strncmp("Height", &name, 5))
+    const int64_t received = Metrics::Now();
+    analysis.lastevaluation = received;
+
+    // The frame handle views the VDO buffer as one NV12 Mat, which has a
+    // different layout than e.g., BGR. The color area reads the Y and UV
+    // planes of its crop directly, so no full frame conversion is needed.
+    const Mat &nv12_mat = frame.Nv12();
+    AnalysisScratch &scratch = analysis.scratch;
+
+    // Swap in new color areas, if any
+    shared_ptr<ChannelRegions> newregions = atomic_exchange(&analysis.pending, shared_ptr<ChannelRegions>());
+    if (newregions)
     {
-        // These values are not to be set by the user but only read by the config UI
-        return;
+        analysis.regions = newregions;
+        // The target may have changed after the color areas were built
+        analysis.targetversion = 0;
+        for (size_t i = 0; i < newregions->regionset->Size(); i++)
+        {
+            analysis.filters[i].Reset();
+        }
+#if defined(DEBUG_WRITE)
+        // A full frame BGR image is only needed for the debug images
+        if (newregions->primary)
+        {
+            cvtColor(nv12_mat, scratch.bgr, COLOR_YUV2BGR_NV12);
+            newregions->regionset->Region(0).WriteDebugImages(scratch.bgr);
+        }
+#endif
     }
+    assert(analysis.regions);
+    const ChannelRegions &regions = *analysis.regions;
+    RegionSet &regionset = *regions.regionset;
 
-    // The following parameters trigger recalibration of the color area
-    mtx.lock();
-    if (0 == strcmp("CenterX", &name))
+    // Swap in new shadow color areas, which start counting from scratch
+    shared_ptr<ChannelRegions> newshadow = atomic_exchange(&analysis.pendingshadow, shared_ptr<ChannelRegions>());
+    if (newshadow)
     {
-        center_point.x = val;
+        analysis.shadow = (0 < newshadow->regionset->Size()) ? newshadow : nullptr;
+        newshadow->regionset->SetMetric(analysis.metric);
+        for (auto index : newshadow->indices)
+        {
+            shadowstats[index].frames = 0;
+            shadowstats[index].agreed = 0;
+            shadowstats[index].shadowwithin = 0;
+            shadowstats[index].livewithin = 0;
+        }
     }
-    else if (0 == strcmp("CenterY", &name))
+    if (analysis.shadow && (newregions || newshadow))
+    {
+        pair_shadow(analysis);
+    }
+
+    // Update the target of the first color area in place
+    bool retarget = false;
+    if (regiontarget.Version() != analysis.targetversion)
     {
-        center_point.y = val;
+        RegionTarget target;
+        analysis.targetversion = regiontarget.Read(target);
+        if (regions.primary)
+        {
+            regionset.SetTarget(0, Scalar(target.color[B], target.color[G], target.color[R]), target.tolerance);
+        }
+        regionset.SetMetric(target.metric);
+        for (size_t i = 0; i < regionset.Size(); i++)
+        {
+            analysis.filters[i].Configure(target.filter);
+        }
+        analysis.metric = target.metric;
+        if (analysis.shadow)
+        {
+            analysis.shadow->regionset->SetMetric(target.metric);
+        }
+        retarget = true;
     }
-    else if (0 == strcmp("ColorR", &name))
+
+    // The crop dump describes the color areas, so it starts over with them
+    const uint32_t dumpframes = cropdumpframes;
+    if (newregions || retarget || dumpframes != analysis.dumpframes)
     {
-        color.val[R] = val;
+        reopen_crop_dump(analysis, dumpframes);
     }
-    else if (0 == strcmp("ColorG", &name))
+
+    // Take a request to capture the current average color
+    if (regions.primary && 0 == analysis.picktarget)
     {
-        color.val[G] = val;
+        analysis.picktarget = pickframes.exchange(0);
+        analysis.pickid = pickgeneration;
+        analysis.pickcount = 0;
+        analysis.picksum = Scalar();
     }
-    else if (0 == strcmp("ColorB", &name))
+
+    const int64_t evaluatestart = Metrics::Now();
+    Metrics::Record(StageSetup, received, evaluatestart);
+    regionset.Evaluate(nv12_mat, scratch.results, taskpool);
+    Metrics::Record(StageAveraging, evaluatestart, Metrics::Now());
+
+    // The pick uses the unfiltered average of the first color area, which the
+    // evaluation has already computed
+    if (0 < analysis.picktarget && regions.primary)
     {
-        color.val[B] = val;
+        for (int c = B; c <= R; c++)
+        {
+            analysis.picksum.val[c] += scratch.results[0].average.val[c];
+        }
+        if (++analysis.pickcount == analysis.picktarget)
+        {
+            pickmtx.lock();
+            for (int c = B; c <= R; c++)
+            {
+                pickedcolor.val[c] = analysis.picksum.val[c] / analysis.pickcount;
+            }
+            pickmtx.unlock();
+            g_idle_add(complete_pick, GUINT_TO_POINTER(analysis.pickid));
+            analysis.picktarget = 0;
+        }
     }
-    else if (0 == strcmp("MarkerWidth", &name))
+    uint8_t states[MAX_REGIONS];
+    for (size_t i = 0; i < scratch.results.size(); i++)
     {
-        markerwidth = val;
+        // Report the smoothed color and the filtered state, so flicker at the
+        // edge of the tolerance does not flip the state every frame
+        const ColorArea &region = regionset.Region(i);
+        states[i] = scratch.results[i].withintolerance ? StateWithin : 0;
+        scratch.results[i].average = analysis.filters[i].Smooth(scratch.results[i].average);
+        scratch.results[i].withintolerance =
+            analysis.filters[i].Update(region.Deviation(scratch.results[i].average), region.GetTolerance(), received);
+        states[i] |= scratch.results[i].withintolerance ? StateReported : 0;
     }
-    else if (0 == strcmp("MarkerHeight", &name))
+
+    // Neither the shadow color areas nor the dump are published
+    if (analysis.shadow)
     {
-        markerheight = val;
+        evaluate_shadow(analysis, nv12_mat, states);
     }
-    else if (0 == strcmp("MarkerShape", &name))
+    if (analysis.cropdump.IsOpen())
     {
-        assert(MarkerCount > val);
-        markershape = val;
+        analysis.cropdump.Write(nv12_mat, states, received);
     }
-    else if (0 == strcmp("Tolerance", &name))
+
+    // Release the VDO frame buffer, nv12_mat is empty from here on
+    frame.Release();
+
+    // Publish the result with the latest readings of the other channels
+    unique_lock<mutex> lock(resultmtx);
+    AnalysisResult &result = channelresult;
+    const uint32_t previousareas = result.numcolorareas;
+    bool moved = false;
+    result.frame++;
+    result.timestamp = g_get_real_time();
+    result.latency = (Metrics::Now() - received) / 1000.0;
+    result.numcolorareas = regions.numcolorareas;
+    bool changed = (previousareas != result.numcolorareas);
+    for (size_t i = 0; i < scratch.results.size(); i++)
     {
-        tolerance = val;
+        const Scalar &average = scratch.results[i].average;
+        const Scalar &target = regionset.Region(i).GetColor();
+        ColorAreaReading &reading = result.colorareas[regions.indices[i]];
+        changed = changed || (reading.withintolerance != scratch.results[i].withintolerance);
+        moved = moved || ADAPTIVE_COLOR_DELTA < fabs(reading.red - average[R]) ||
+                ADAPTIVE_COLOR_DELTA < fabs(reading.green - average[G]) ||
+                ADAPTIVE_COLOR_DELTA < fabs(reading.blue - average[B]);
+        reading.red = average[R];
+        reading.green = average[G];
+        reading.blue = average[B];
+        reading.reddiff = average[R] - target[R];
+        reading.greendiff = average[G] - target[G];
+        reading.bluediff = average[B] - target[B];
+        reading.withintolerance = scratch.results[i].withintolerance;
     }
-    else
+    result.statechanges += changed;
+    // The snapshot serves the status requests
+    analysisresults.Publish(result);
+    AnalysisResult &published = scratch.published;
+    published = result;
+    lock.unlock();
+    if (changed || moved)
     {
-        LOG_E("%s/%s: FAILED to act on param %s", __FILE__, __FUNCTION__, &name);
-        throw runtime_error("Unknown int parameter.");
+        fullrateuntil = Metrics::Now() + ADAPTIVE_HOLD_MS * 1000;
     }
 
-    purge_colorarea();
-    mtx.unlock();
-}
-
-static void param_callback_double(const gchar *name, const gchar *value, void *data)
-{
-    assert(nullptr != name);
-    assert(nullptr != value);
-    (void)data;
-    if (nullptr == value)
+    // The OPC UA server and the events get every result in order, and publish
+    // them while the next frames are evaluated. Only the thread whose turn it
+    // is pushes, so each queue keeps a single producer, and waiting for a
+    // full queue only holds back the results behind this one.
+    unique_lock<mutex> turn(publishmtx);
+    publishturn.wait(turn, [&published] { return nextpublished == published.frame; });
+    turn.unlock();
+    opcuaserver.Publish(published);
+    if (changed)
     {
-        LOG_E("%s/%s: Unexpected nullptr value for %s", __FILE__, __FUNCTION__, name);
-        return;
+        queue_event_states(published);
     }
+    turn.lock();
+    nextpublished++;
+    turn.unlock();
+    publishturn.notify_all();
 
-    LOG_I("Update for parameter %s (%s)", name, value);
-    auto lastdot = strrchr(name, '.');
-    assert(nullptr != lastdot);
-    assert(1 < strlen(name) - strlen(lastdot));
-    update_local_param_double(lastdot[1], atof(value));
+    return true;
 }
 
-static void param_callback_int(const gchar *name, const gchar *value, void *data)
+static void analysis_thread_entry(ChannelAnalysis *analysis)
 {
-    assert(nullptr != name);
-    assert(nullptr != value);
-    (void)data;
-    if (nullptr == value)
+    assert(nullptr != analysis);
+    LOG_I("%s/%s: Image analysis thread of channel %u started", __FILE__, __FUNCTION__, analysis->channel);
+    while (analysisrunning && imageanalysis(*analysis))
     {
-        LOG_E("%s/%s: Unexpected nullptr value for %s", __FILE__, __FUNCTION__, name);
-        return;
     }
-
-    LOG_I("Update for parameter %s (%s)", name, value);
-    auto lastdot = strrchr(name, '.');
-    assert(nullptr != lastdot);
-    assert(1 < strlen(name) - strlen(lastdot));
-    update_local_param_int(lastdot[1], atoi(value));
+    LOG_I("%s/%s: Image analysis thread of channel %u stopped", __FILE__, __FUNCTION__, analysis->channel);
 }
 
-static gboolean setup_param(AXParameter &axparameter, const gchar *name, AXParameterCallback callbackfn)
+/**
+ * brief Set up the stream of one channel.
+ *
+ * param analysis Channel to set up.
+ * param scale Smallest scale of the config resolution the markers need.
+ * return False if the stream could not be set up.
+ */
+static gboolean initchannel(ChannelAnalysis &analysis, const double scale)
 {
-    GError *error = nullptr;
-
-    assert(nullptr != name);
-    assert(nullptr != callbackfn);
-
-    if (!ax_parameter_register_callback(&axparameter, name, callbackfn, &axparameter, &error))
+    const unsigned int channel = analysis.channel;
+    unsigned int streamWidth = configsize.width;
+    unsigned int streamHeight = configsize.height;
+
+    // Analyze a downscaled stream if the markers are large enough. The stream
+    // has to show the same field of view, so only resolutions of the same
+    // aspect ratio are considered. VDO offers no cropped streams, so the
+    // region bounding boxes do not limit the stream further.
+    if (ResolutionAuto == analysisresolution)
     {
-        LOG_E("%s/%s: failed to register %s callback", __FILE__, __FUNCTION__, name);
-        if (nullptr != error)
+        const unsigned int minwidth = ceil(configsize.width * scale);
+        const unsigned int minheight = ceil(configsize.height * scale);
+        if (!ImgProvider::ChooseStreamResolution(
+                channel,
+                minwidth,
+                minheight,
+                streamWidth,
+                streamHeight,
+                configsize.width,
+                configsize.height))
         {
-            LOG_E("%s/%s: %s", __FILE__, __FUNCTION__, error->message);
-            g_error_free(error);
+            LOG_E("%s/%s: Failed choosing analysis stream resolution", __FILE__, __FUNCTION__);
+            return FALSE;
         }
-        return FALSE;
+        // NV12 needs even dimensions
+        streamWidth &= ~1u;
+        streamHeight &= ~1u;
     }
 
-    return TRUE;
-}
-
-static gboolean setup_param_double(AXParameter &axparameter, const gchar *name, AXParameterCallback callbackfn)
-{
-    if (!setup_param(axparameter, name, callbackfn))
+    LOG_I("Creating VDO image provider and creating stream %d x %d on channel %u", streamWidth, streamHeight, channel);
+    analysis.provider = new ImgProvider(channel, streamWidth, streamHeight, framerate, VDO_FORMAT_YUV);
+    if (!analysis.provider)
     {
+        LOG_E("%s/%s: Failed to create ImgProvider", __FILE__, __FUNCTION__);
+        return FALSE;
+    }
+    if (!analysis.provider->InitImgProvider())
+    {
+        LOG_E("%s/%s: Failed to init ImgProvider", __FILE__, __FUNCTION__);
         return FALSE;
     }
 
-    double val;
-    if (!get_param_double(axparameter, name, val))
+    LOG_I("Start fetching video frames from VDO");
+    if (!ImgProvider::StartFrameFetch(*analysis.provider))
     {
-        LOG_E("%s/%s: Failed to get initial value for %s", __FILE__, __FUNCTION__, name);
+        LOG_E("%s/%s: Failed to fetch frames from VDO", __FILE__, __FUNCTION__);
         return FALSE;
     }
-    update_local_param_double(*name, val);
-    LOG_I("%s/%s: Set up parameter %s", __FILE__, __FUNCTION__, name);
-    usleep(50000); // mitigate timing issue in parameter handling
+
+    analysis.scratch.results.reserve(MAX_REGIONS);
+    analysis.scratch.shadowresults.reserve(MAX_REGIONS);
+#if defined(DEBUG_WRITE)
+    analysis.scratch.bgr.create(streamHeight, streamWidth, CV_8UC3);
+#endif
 
     return TRUE;
 }
 
-static gboolean setup_param_int(AXParameter &axparameter, const gchar *name, AXParameterCallback callbackfn)
+/**
+ * brief Set up the streams of the channels with color areas.
+ *
+ * The config resolution does not depend on the parameters, so it is chosen
+ * while they are loaded. The channels and the stream resolutions depend on
+ * the color areas, so they are set up once the parameters are in.
+ *
+ * param w Width of the smallest config resolution.
+ * param h Height of the smallest config resolution.
+ * param paramsloaded Becomes true once the parameters are loaded, or false if
+ *        loading them failed.
+ * return False if the image analysis could not be set up.
+ */
+static gboolean initimageanalysis(const unsigned int w, const unsigned int h, future<bool> &paramsloaded)
 {
-    if (!setup_param(axparameter, name, callbackfn))
+    // chooseStreamResolution gets the least resource intensive stream
+    // that exceeds or equals the desired resolution specified above. The
+    // color area coordinates of all channels are given in the resolution of
+    // the first channel.
+    unsigned int streamWidth = 0;
+    unsigned int streamHeight = 0;
+    const bool chosen = ImgProvider::ChooseStreamResolution(DEFAULT_CHANNEL, w, h, streamWidth, streamHeight);
+    configsize = Size(streamWidth, streamHeight);
+    if (!paramsloaded.get())
     {
         return FALSE;
     }
-
-    int val;
-    if (!get_param_int(axparameter, name, val))
+    if (!chosen)
     {
-        LOG_E("%s/%s: Failed to get initial value for %s", __FILE__, __FUNCTION__, name);
+        LOG_E("%s/%s: Failed choosing stream resolution", __FILE__, __FUNCTION__);
         return FALSE;
     }
-    update_local_param_int(*name, val);
-    LOG_I("%s/%s: Set up parameter %s", __FILE__, __FUNCTION__, name);
-    usleep(50000); // mitigate timing issue in parameter handling
-
-    return TRUE;
-}
 
-static gboolean imageanalysis(gpointer data)
-{
-    (void)data;
-    // Get the latest NV12 image frame from VDO using the imageprovider
-    assert(nullptr != provider);
-    VdoBuffer *buf = ImgProvider::GetLastFrameBlocking(*provider);
-    if (!buf)
+    // Analyze every channel that has a color area, the channel of the first
+    // color area first
+    vector<RegionSpec> specs;
+    mtx.lock();
+    const double scale = get_required_scale();
+    get_region_specs(specs);
+    bool used[MAX_CHANNELS + 1] = {false};
+    for (auto &spec : specs)
     {
-        LOG_I("%s/%s: No more frames available, exiting", __FILE__, __FUNCTION__);
-        return TRUE;
+        used[spec.channel] = true;
     }
-
-    // Assign the VDO image buffer to the nv12_mat OpenCV Mat.
-    // This specific Mat is used as it is the one we created for NV12,
-    // which has a different layout than e.g., BGR.
-    mtx.lock();
-    nv12_mat.data = static_cast<uint8_t *>(vdo_buffer_get_data(buf));
-
-    // Convert the NV12 data to BRG
-    Mat bgr_mat;
-    cvtColor(nv12_mat, bgr_mat, COLOR_YUV2BGR_NV12);
-
-    // Handle request to capture current average color
-    if (pickcurrent && nullptr != colorarea)
+    channelanalyses[0].channel = DEFAULT_CHANNEL;
+    size_t count = 1;
+    for (unsigned int channel = 1; channel <= MAX_CHANNELS; channel++)
     {
-        color = colorarea->GetAverageColor(bgr_mat);
-        LOG_I(
-            "%s/%s: Picked current average color: %.1f %.1f %.1f",
-            __FILE__,
-            __FUNCTION__,
-            color.val[R],
-            color.val[G],
-            color.val[B]);
-        assert(nullptr != axparameter);
-        if (!set_param_double(*axparameter, "ColorB", color.val[B], FALSE) ||
-            !set_param_double(*axparameter, "ColorG", color.val[G], FALSE) ||
-            !set_param_double(*axparameter, "ColorR", color.val[R], TRUE))
+        if (used[channel] && DEFAULT_CHANNEL != channel)
         {
-            LOG_E("%s/%s: Failed to set picked color", __FILE__, __FUNCTION__);
+            channelanalyses[count++].channel = channel;
         }
-        purge_colorarea();
-        pickcurrent = false;
     }
+    numchannels = count;
+    mtx.unlock();
 
-    // Create color area if nonexistent
-    if (nullptr == colorarea)
+    for (size_t c = 0; c < numchannels; c++)
     {
-        LOG_I("%s/%s: Set up new colorarea", __FILE__, __FUNCTION__);
-        switch (markershape)
+        if (!initchannel(channelanalyses[c], scale))
         {
-        case Ellipse:
-            colorarea = new ColorAreaEllipse(bgr_mat, center_point, color, markerwidth, markerheight, tolerance);
-            break;
-        case Rectangle:
-            colorarea = new ColorAreaRectangle(bgr_mat, center_point, color, markerwidth, markerheight, tolerance);
-            break;
-        default:
-            throw runtime_error("Unknown marker shape value used.");
-            break;
+            LOG_E("%s/%s: Failed to set up channel %u", __FILE__, __FUNCTION__, channelanalyses[c].channel);
+            return FALSE;
         }
     }
-    assert(nullptr != colorarea);
-    const bool newstate = colorarea->ColorAreaValueWithinTolerance(bgr_mat);
-    opcuaserver.UpdateColorAreaValue(newstate);
-    if (newstate != currentstate)
+
+    // Set up the color areas before the first frame is analyzed
+    mtx.lock();
+    for (size_t c = 0; c < numchannels; c++)
     {
-        // Trigger Axis event for state change
-        evhandler.Send(newstate);
-        currentstate = newstate;
+        const ImgProvider &provider = *channelanalyses[c].provider;
+        channelanalyses[c].analysissize = Size(provider.Width(), provider.Height());
     }
+    rebuild_regionset();
+    rebuild_shadow();
+    update_target();
     mtx.unlock();
 
-    // Release the VDO frame buffer
-    ImgProvider::ReturnFrame(*provider, *buf);
-
     return TRUE;
 }
 
-static gboolean initimageanalysis(AXParameter &axparameter, const unsigned int w, const unsigned int h)
+/**
+ * brief Update the ACAP parameters width and height to the config resolution,
+ * for the config UI to read.
+ */
+static gboolean publish_config_resolution(AXParameter &axparameter)
 {
-    // chooseStreamResolution gets the least resource intensive stream
-    // that exceeds or equals the desired resolution specified above
-    unsigned int streamWidth = 0;
-    unsigned int streamHeight = 0;
-    if (!ImgProvider::ChooseStreamResolution(w, h, streamWidth, streamHeight))
-    {
-        LOG_E("%s/%s: Failed choosing stream resolution", __FILE__, __FUNCTION__);
-        return FALSE;
-    }
-
-    // Update the ACAP parameters width and height accordingly, for the config
-    // UI to read
     GError *error = nullptr;
     char param[128];
-    snprintf(param, 127, "%u", streamWidth);
+    snprintf(param, 127, "%d", configsize.width);
     if (!ax_parameter_set(&axparameter, "Width", param, TRUE, &error))
     {
         LOG_E("%s/%s: Failed to update Width", __FILE__, __FUNCTION__);
         g_error_free(error);
         return FALSE;
     }
-    snprintf(param, 127, "%u", streamHeight);
+    snprintf(param, 127, "%d", configsize.height);
     if (!ax_parameter_set(&axparameter, "Height", param, TRUE, &error))
     {
         LOG_E("%s/%s: Failed to update Height", __FILE__, __FUNCTION__);
         g_error_free(error);
         return FALSE;
     }
-
-    LOG_I("Creating VDO image provider and creating stream %d x %d", streamWidth, streamHeight);
-    provider = new ImgProvider(streamWidth, streamHeight, 2, VDO_FORMAT_YUV);
-    if (!provider)
-    {
-        LOG_E("%s/%s: Failed to create ImgProvider", __FILE__, __FUNCTION__);
-        return FALSE;
-    }
-    if (!provider->InitImgProvider())
-    {
-        LOG_E("%s/%s: Failed to init ImgProvider", __FILE__, __FUNCTION__);
-        return FALSE;
-    }
-
-    LOG_I("Start fetching video frames from VDO");
-    if (!ImgProvider::StartFrameFetch(*provider))
-    {
-        LOG_E("%s/%s: Failed to fetch frames from VDO", __FILE__, __FUNCTION__);
-        return FALSE;
-    }
-
-    // OpenCV represents NV12 with 1.5 bytes per pixel
-    nv12_mat = Mat(streamHeight * 3 / 2, streamWidth, CV_8UC1);
-
     return TRUE;
 }
 
@@ -494,6 +1398,274 @@ static void write_internal_error(GDataOutputStream &dos, const char *msg)
     write_error_response(dos, 500, "Internal Server Error", msg);
 }
 
+/**
+ * brief Answer all waiting pickcurrent.cgi requests and end the pick.
+ *
+ * param picked The picked color, or nullptr if the pick failed.
+ */
+static void finish_pick(const Scalar *picked)
+{
+    for (auto stream : pickrequests)
+    {
+        auto dos = g_data_output_stream_new(stream);
+        assert(nullptr != dos);
+        if (nullptr == picked)
+        {
+            write_internal_error(*dos, "Failed to pick current color");
+        }
+        else
+        {
+            g_data_output_stream_put_string(dos, "Status: 200 OK\r\n", nullptr, nullptr);
+            g_data_output_stream_put_string(dos, "Content-Type: application/json\r\n\r\n", nullptr, nullptr);
+            ostringstream ss;
+            ss << "{\"R\":" << picked->val[R] << ", \"G\":" << picked->val[G] << ", \"B\":" << picked->val[B] << "}"
+               << endl;
+            g_data_output_stream_put_string(dos, ss.str().c_str(), nullptr, nullptr);
+        }
+        // Dropping the data stream closes the stream, which ends the response
+        g_object_unref(dos);
+        g_object_unref(stream);
+    }
+    pickrequests.clear();
+    if (0 != picktimer)
+    {
+        g_source_remove(picktimer);
+        picktimer = 0;
+    }
+}
+
+/**
+ * brief Store the color picked by the analysis thread and answer the requests.
+ *
+ * Runs in the main loop. The three color parameters are written with a
+ * single sync, and their callbacks then update the target once.
+ *
+ * param data Generation of the pick.
+ */
+static gboolean complete_pick(gpointer data)
+{
+    if (GPOINTER_TO_UINT(data) != pickgeneration || pickrequests.empty())
+    {
+        // The pick has timed out
+        return G_SOURCE_REMOVE;
+    }
+
+    pickmtx.lock();
+    const Scalar picked = pickedcolor;
+    pickmtx.unlock();
+    LOG_I(
+        "%s/%s: Picked current average color: %.1f %.1f %.1f",
+        __FILE__,
+        __FUNCTION__,
+        picked.val[R],
+        picked.val[G],
+        picked.val[B]);
+
+    assert(nullptr != axparameter);
+    if (!set_param_double(*axparameter, "ColorB", picked.val[B], FALSE) ||
+        !set_param_double(*axparameter, "ColorG", picked.val[G], FALSE) ||
+        !set_param_double(*axparameter, "ColorR", picked.val[R], TRUE))
+    {
+        LOG_E("%s/%s: Failed to set picked color", __FILE__, __FUNCTION__);
+        finish_pick(nullptr);
+    }
+    else
+    {
+        finish_pick(&picked);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean pick_timeout(gpointer data)
+{
+    (void)data;
+    LOG_E("%s/%s: Timed out waiting for frames", __FILE__, __FUNCTION__);
+    picktimer = 0;
+    // Make the analysis thread's result of this pick stale
+    pickframes = 0;
+    pickgeneration++;
+    finish_pick(nullptr);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * brief Serve pickcurrent.cgi without blocking the main loop.
+ *
+ * The request is handed to the analysis thread, which averages the first
+ * color area over the next frames=N (default 1) frames. The response is sent
+ * once the color is stored. Requests coming in during a pick share its result.
+ */
+static void handle_pick_request(GDataOutputStream &dos, GOutputStream &stream, GHashTable *params)
+{
+    const gchar *framesstr = (nullptr != params) ? (const gchar *)g_hash_table_lookup(params, "frames") : nullptr;
+    const int frames = (nullptr != framesstr) ? atoi(framesstr) : 1;
+    if (1 > frames || PICK_MAX_FRAMES < frames)
+    {
+        write_bad_request(dos, "Invalid number of frames");
+        return;
+    }
+
+    // Answered by finish_pick(), so the data stream of request_handler() must
+    // not close the stream when dropped
+    g_filter_output_stream_set_close_base_stream(G_FILTER_OUTPUT_STREAM(&dos), FALSE);
+    pickrequests.push_back(G_OUTPUT_STREAM(g_object_ref(&stream)));
+    if (0 != picktimer)
+    {
+        // A pick is already in progress
+        return;
+    }
+    pickgeneration++;
+    pickframes = frames;
+    fullrateuntil = Metrics::Now() + ADAPTIVE_HOLD_MS * 1000;
+    picktimer = g_timeout_add(PICK_TIMEOUT_MS + (guint)(frames * 1000 / framerate), pick_timeout, nullptr);
+}
+
+static void write_status(GDataOutputStream &dos, const AnalysisResult &result)
+{
+    const bool status = 0 < result.numcolorareas && result.colorareas[0].withintolerance;
+    g_data_output_stream_put_string(&dos, "Status: 200 OK\r\n", nullptr, nullptr);
+    g_data_output_stream_put_string(&dos, "Content-Type: application/json\r\n", nullptr, nullptr);
+    g_data_output_stream_put_string(&dos, "Cache-Control: no-store\r\n\r\n", nullptr, nullptr);
+    ostringstream ss;
+    ss << "{\"status\": " << (status ? "true" : "false") << ", \"frame\": " << result.frame
+       << ", \"changes\": " << result.statechanges << ", \"regions\": [";
+    for (size_t i = 0; i < result.numcolorareas; i++)
+    {
+        ss << (0 < i ? ", " : "") << (result.colorareas[i].withintolerance ? "true" : "false");
+    }
+    ss << "], \"colors\": [";
+    for (size_t i = 0; i < result.numcolorareas; i++)
+    {
+        const ColorAreaReading &reading = result.colorareas[i];
+        ss << (0 < i ? ", " : "") << "[" << reading.red << ", " << reading.green << ", " << reading.blue << "]";
+    }
+    ss << "]}" << endl;
+    g_data_output_stream_put_string(&dos, ss.str().c_str(), nullptr, nullptr);
+}
+
+/**
+ * brief Answer a waiting getstatus.cgi request and drop its stream.
+ */
+static void answer_status_request(GOutputStream &stream, const AnalysisResult &result)
+{
+    auto dos = g_data_output_stream_new(&stream);
+    assert(nullptr != dos);
+    write_status(*dos, result);
+    // Dropping the data stream closes the stream, which ends the response
+    g_object_unref(dos);
+    g_object_unref(&stream);
+}
+
+static bool status_request_ready(const StatusRequest &request, const AnalysisResult &result)
+{
+    return request.known != (request.waitframe ? result.frame : result.statechanges);
+}
+
+/**
+ * brief Answer the waiting getstatus.cgi requests that have a newer result.
+ *
+ * Runs in the main loop while there are waiting requests. All of them are
+ * served from one read of the result snapshot.
+ */
+static gboolean check_status_requests(gpointer data)
+{
+    (void)data;
+    AnalysisResult result;
+    analysisresults.Read(result);
+    const int64_t now = Metrics::Now();
+    size_t kept = 0;
+    for (auto &request : statusrequests)
+    {
+        if (status_request_ready(request, result) || now >= request.deadline)
+        {
+            answer_status_request(*request.stream, result);
+        }
+        else
+        {
+            statusrequests[kept++] = request;
+        }
+    }
+    statusrequests.resize(kept);
+    if (statusrequests.empty())
+    {
+        statustimer = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * brief Serve getstatus.cgi.
+ *
+ * Without parameters the latest status is returned at once. With changes=N
+ * (or frame=N) the response is held back until the state change counter (or
+ * frame counter) differs from N, or at most STATUS_WAIT_TIMEOUT_MS, so a
+ * client gets each change as it happens from one request at a time instead
+ * of polling.
+ */
+static void handle_status_request(GDataOutputStream &dos, GOutputStream &stream, GHashTable *params)
+{
+    AnalysisResult result;
+    analysisresults.Read(result);
+
+    StatusRequest request;
+    const gchar *changes = (nullptr != params) ? (const gchar *)g_hash_table_lookup(params, "changes") : nullptr;
+    const gchar *frame = (nullptr != params) ? (const gchar *)g_hash_table_lookup(params, "frame") : nullptr;
+    if ((nullptr == changes && nullptr == frame) || MAX_STATUS_REQUESTS <= statusrequests.size())
+    {
+        write_status(dos, result);
+        return;
+    }
+    request.waitframe = (nullptr != frame);
+    request.known = strtoull(request.waitframe ? frame : changes, nullptr, 10);
+    if (status_request_ready(request, result))
+    {
+        write_status(dos, result);
+        return;
+    }
+
+    // Keep the response open until there is something new to tell. The data
+    // stream of request_handler() would otherwise close it when dropped.
+    g_filter_output_stream_set_close_base_stream(G_FILTER_OUTPUT_STREAM(&dos), FALSE);
+    request.stream = G_OUTPUT_STREAM(g_object_ref(&stream));
+    request.deadline = Metrics::Now() + STATUS_WAIT_TIMEOUT_MS * 1000;
+    statusrequests.push_back(request);
+    if (0 == statustimer)
+    {
+        statustimer = g_timeout_add(STATUS_CHECK_MS, check_status_requests, nullptr);
+    }
+}
+
+/**
+ * brief Serve shadow.cgi, how often the shadow color areas agree with the live ones.
+ */
+static void handle_shadow_request(GDataOutputStream &dos)
+{
+    g_data_output_stream_put_string(&dos, "Status: 200 OK\r\n", nullptr, nullptr);
+    g_data_output_stream_put_string(&dos, "Content-Type: application/json\r\n\r\n", nullptr, nullptr);
+    ostringstream ss;
+    ss << "{\"areas\": [";
+    const uint32_t areas = numshadowareas;
+    for (uint32_t i = 0; i < areas; i++)
+    {
+        const ShadowStats &stats = shadowstats[i];
+        const uint64_t frames = stats.frames.load(memory_order_relaxed);
+        const uint64_t agreed = stats.agreed.load(memory_order_relaxed);
+        ss << (0 < i ? ", " : "") << "{\"index\": " << i << ", \"frames\": " << frames << ", \"agreed\": " << agreed
+           << ", \"agreement\": " << (0 < frames ? static_cast<double>(agreed) / frames : 0.0)
+           << ", \"shadowwithin\": " << stats.shadowwithin.load(memory_order_relaxed)
+           << ", \"livewithin\": " << stats.livewithin.load(memory_order_relaxed) << "}";
+    }
+    const LatencyHistogram &live = Metrics::Histogram(StageAveraging);
+    const LatencyHistogram &shadow = Metrics::Histogram(StageShadow);
+    ss << "], \"live_p50_us\": " << live.Percentile(50) << ", \"live_p99_us\": " << live.Percentile(99)
+       << ", \"shadow_p50_us\": " << shadow.Percentile(50) << ", \"shadow_p99_us\": " << shadow.Percentile(99)
+       << "}" << endl;
+    g_data_output_stream_put_string(&dos, ss.str().c_str(), nullptr, nullptr);
+}
+
 static void request_handler(
     const gchar *path,
     const gchar *method,
@@ -504,7 +1676,6 @@ static void request_handler(
 {
     (void)method;
     (void)query;
-    (void)params;
     (void)user_data;
 
     auto dos = g_data_output_stream_new(output_stream);
@@ -513,42 +1684,37 @@ static void request_handler(
     const char *func = basename(const_cast<char *>(path));
     if (0 == strcmp("getstatus.cgi", func))
     {
-        const bool status = opcuaserver.GetColorAreaValue();
+        handle_status_request(*dos, *output_stream, params);
+    }
+    else if (0 == strcmp("metrics.cgi", func))
+    {
         g_data_output_stream_put_string(dos, "Status: 200 OK\r\n", nullptr, nullptr);
         g_data_output_stream_put_string(dos, "Content-Type: application/json\r\n\r\n", nullptr, nullptr);
         ostringstream ss;
-        ss << "{\"status\": " << (status ? "true" : "false") << "}" << endl;
+        ss << "{";
+        for (size_t i = 0; i < StageCount; i++)
+        {
+            const MetricStage stage = static_cast<MetricStage>(i);
+            const LatencyHistogram &histogram = Metrics::Histogram(stage);
+            ss << (0 < i ? ", " : "") << "\"" << Metrics::StageName(stage) << "\": {\"count\": " << histogram.Count()
+               << ", \"p50_us\": " << histogram.Percentile(50) << ", \"p99_us\": " << histogram.Percentile(99)
+               << ", \"max_us\": " << histogram.Max() << "}";
+        }
+        ss << "}" << endl;
         g_data_output_stream_put_string(dos, ss.str().c_str(), nullptr, nullptr);
     }
     else if (0 == strcmp("pickcurrent.cgi", func))
     {
-        pickcurrent = true;
-        if (!imageanalysis(nullptr))
-        {
-            write_internal_error(*dos, "Failed to pick current color");
-            goto http_exit;
-        }
-        double blue;
-        double green;
-        double red;
-        assert(nullptr != axparameter);
-        if (!get_param_double(*axparameter, "ColorB", blue) || !get_param_double(*axparameter, "ColorG", green) ||
-            !get_param_double(*axparameter, "ColorR", red))
-        {
-            write_internal_error(*dos, "Inner parameter retrieval error");
-            goto http_exit;
-        }
-        g_data_output_stream_put_string(dos, "Status: 200 OK\r\n", nullptr, nullptr);
-        g_data_output_stream_put_string(dos, "Content-Type: application/json\r\n\r\n", nullptr, nullptr);
-        ostringstream ss;
-        ss << "{\"R\":" << red << ", \"G\":" << green << ", \"B\":" << blue << "}" << endl;
-        g_data_output_stream_put_string(dos, ss.str().c_str(), nullptr, nullptr);
+        handle_pick_request(*dos, *output_stream, params);
+    }
+    else if (0 == strcmp("shadow.cgi", func))
+    {
+        handle_shadow_request(*dos);
     }
     else
     {
         write_bad_request(*dos, "Unknown action");
     }
-http_exit:
     g_object_unref(dos);
 }
 
@@ -559,9 +1725,12 @@ static void signalHandler(int signal_num)
     case SIGTERM:
     case SIGABRT:
     case SIGINT:
-        if (nullptr != provider)
+        for (size_t c = 0; c < numchannels; c++)
         {
-            ImgProvider::StopFrameFetch(*provider);
+            if (nullptr != channelanalyses[c].provider)
+            {
+                ImgProvider::StopFrameFetch(*channelanalyses[c].provider);
+            }
         }
         g_main_loop_quit(loop);
         break;
@@ -599,8 +1768,16 @@ int main(int argc, char *argv[])
 
     AXHttpHandler *axhttp = nullptr;
     GError *error = nullptr;
+    thread *initthread = nullptr;
+    gboolean imageanalysisready = FALSE;
+    promise<bool> paramsready;
+    future<bool> paramsloaded = paramsready.get_future();
     const char *app_name = "opcuacolorchecker";
     openlog(app_name, LOG_PID | LOG_CONS, LOG_USER);
+    if (!Log::Start())
+    {
+        LOG_E("%s/%s: Failed to start the log thread, logging directly", __FILE__, __FUNCTION__);
+    }
 
     int result = EXIT_SUCCESS;
     if (!initializeSignalHandler())
@@ -609,6 +1786,9 @@ int main(int argc, char *argv[])
         goto exit;
     }
 
+    // The worker threads are capped by the MaxWorkerThreads parameter
+    taskpool = new TaskPool(TaskPool::DefaultWorkers());
+
     // Init parameter handling (will also launch OPC UA server)
     LOG_I("Init parameter handling ...");
     axparameter = ax_parameter_new(app_name, &error);
@@ -620,25 +1800,22 @@ int main(int argc, char *argv[])
         goto exit;
     }
     LOG_I("%s/%s: ax_parameter_new success", __FILE__, __FUNCTION__);
-    // clang-format off
-    if (!setup_param_int(*axparameter, "CenterX", param_callback_int) ||
-        !setup_param_int(*axparameter, "CenterY", param_callback_int) ||
-        !setup_param_double(*axparameter, "ColorB", param_callback_double) ||
-        !setup_param_double(*axparameter, "ColorG", param_callback_double) ||
-        !setup_param_double(*axparameter, "ColorR", param_callback_double) ||
-        !setup_param_int(*axparameter, "Height", param_callback_int) ||
-        !setup_param_int(*axparameter, "MarkerHeight", param_callback_int) ||
-        !setup_param_int(*axparameter, "MarkerShape", param_callback_int) ||
-        !setup_param_int(*axparameter, "MarkerWidth", param_callback_int) ||
-        !setup_param_int(*axparameter, "Port", param_callback_int) ||
-        !setup_param_int(*axparameter, "Tolerance", param_callback_int) ||
-        !setup_param_int(*axparameter, "Width", param_callback_int))
-    // clang-format on
+
+    // Initialize image analysis while the parameters are loaded and their
+    // callbacks are registered
+    initthread = new thread([&imageanalysisready, &paramsloaded]
+                            { imageanalysisready = initimageanalysis(640, 360, paramsloaded); });
+    // Get all values first; this also launches the OPC UA server
+    if (!load_params(*axparameter))
     {
-        LOG_E("%s/%s: Failed to set up parameters", __FILE__, __FUNCTION__);
+        LOG_E("%s/%s: Failed to load parameters", __FILE__, __FUNCTION__);
+        paramsready.set_value(false);
+        initthread->join();
+        delete initthread;
         result = EXIT_FAILURE;
-        goto exit_param;
+        goto exit_analysis;
     }
+    paramsready.set_value(true);
     // Log retrieved param values
     LOG_I("%s/%s: center: (%u, %u)", __FILE__, __FUNCTION__, center_point.x, center_point.y);
     LOG_I(
@@ -651,30 +1828,42 @@ int main(int argc, char *argv[])
     LOG_I("%s/%s: marker dimenstions (w, h) = (%u, %u)", __FILE__, __FUNCTION__, markerwidth, markerheight);
     LOG_I("%s/%s: marker shape = %u", __FILE__, __FUNCTION__, markershape);
     LOG_I("%s/%s: tolerance: %u", __FILE__, __FUNCTION__, tolerance);
+    LOG_I("%s/%s: additional regions: '%s'", __FILE__, __FUNCTION__, regions.c_str());
 
-    // Initialize image analysis
-    if (!initimageanalysis(*axparameter, 640, 360))
+    if (!register_params(*axparameter))
     {
-        LOG_E("%s/%s: Failed to init image analysis", __FILE__, __FUNCTION__);
+        LOG_E("%s/%s: Failed to set up parameters", __FILE__, __FUNCTION__);
         result = EXIT_FAILURE;
-        goto exit_param;
     }
-
-    // Add image analysis as idle function
-    if (1 > g_idle_add(imageanalysis, nullptr))
+    initthread->join();
+    delete initthread;
+    if (EXIT_SUCCESS != result)
     {
-        LOG_E("%s/%s: Failed to add idle function", __FILE__, __FUNCTION__);
+        goto exit_analysis;
+    }
+    if (!imageanalysisready || !publish_config_resolution(*axparameter))
+    {
+        LOG_E("%s/%s: Failed to init image analysis", __FILE__, __FUNCTION__);
         result = EXIT_FAILURE;
-        goto exit_param;
+        goto exit_analysis;
     }
 
-    // Add means to get value through HTTP too
-    axhttp = ax_http_handler_new(request_handler, &pickcurrent);
+    // Add means to get value through HTTP too, before any analysis thread
+    // is started so that a failure leaves nothing to stop
+    axhttp = ax_http_handler_new(request_handler, nullptr);
     if (nullptr == axhttp)
     {
         LOG_E("%s/%s: Failed to set up HTTP handler", __FILE__, __FUNCTION__);
         result = EXIT_FAILURE;
-        goto exit_param;
+        goto exit_analysis;
+    }
+
+    // Run the image analysis of each channel in a thread of its own, so the
+    // channels are analyzed in parallel on the available cores
+    analysisrunning = true;
+    for (size_t c = 0; c < numchannels; c++)
+    {
+        channelanalyses[c].worker = new thread(analysis_thread_entry, &channelanalyses[c]);
     }
 
     LOG_I("Start main loop ...");
@@ -684,19 +1873,47 @@ int main(int argc, char *argv[])
 
     // Cleanup
     LOG_I("Shutdown ...");
+    if (0 != statustimer)
+    {
+        g_source_remove(statustimer);
+    }
+    for (auto &request : statusrequests)
+    {
+        g_object_unref(request.stream);
+    }
+    finish_pick(nullptr);
     ax_http_handler_free(axhttp);
     g_main_loop_unref(loop);
-    if (nullptr != provider)
+    // The frame fetching has been stopped by the signal handler, which also
+    // wakes up the analysis threads
+    analysisrunning = false;
+    for (size_t c = 0; c < numchannels; c++)
     {
-        delete provider;
+        if (nullptr != channelanalyses[c].worker)
+        {
+            channelanalyses[c].worker->join();
+            delete channelanalyses[c].worker;
+        }
     }
-    opcuaserver.ShutDownServer();
 
-exit_param:
+exit_analysis:
+    // Deleting the providers also stops the frame fetching
+    for (size_t c = 0; c < numchannels; c++)
+    {
+        delete channelanalyses[c].provider;
+        channelanalyses[c].provider = nullptr;
+    }
+    // The server is launched while the parameters are loaded
+    if (opcuaserver.IsRunning())
+    {
+        opcuaserver.ShutDownServer();
+    }
     ax_parameter_free(axparameter);
 
 exit:
+    delete taskpool;
     LOG_I("Exiting!");
+    Log::Stop();
     closelog();
 
     return result;
@@ -15,20 +15,73 @@
  */
 
 #include <assert.h>
+#include <chrono>
+#include <cmath>
 
 #include "common.hpp"
+#include "metrics.hpp"
 #include "opcuaserver.hpp"
 
 using namespace std;
 
-#define LABEL (char *)"ColorAreaReading"
+/// Browse names and data types of the ColorAreaType variables
+static const struct
+{
+    const char *name;
+    size_t type;
+} AREA_VARIABLES[AreaVariableCount] = {
+    {"WithinTolerance", UA_TYPES_BOOLEAN},
+    {"MeasuredRed", UA_TYPES_DOUBLE},
+    {"MeasuredGreen", UA_TYPES_DOUBLE},
+    {"MeasuredBlue", UA_TYPES_DOUBLE},
+    {"DifferenceRed", UA_TYPES_DOUBLE},
+    {"DifferenceGreen", UA_TYPES_DOUBLE},
+    {"DifferenceBlue", UA_TYPES_DOUBLE},
+    {"Frame", UA_TYPES_UINT64},
+    {"Latency", UA_TYPES_DOUBLE},
+};
+
+#define LABEL "ColorAreaReading"
+#define LABEL_SIZE (64)
+#define HEARTBEAT_LABEL "LastEvaluated"
+#define OBJECT_LABEL "ColorArea"
+#define OBJECT_TYPE_LABEL "ColorAreaType"
+#define DIAGNOSTICS_LABEL "Diagnostics"
+// How often new analysis results are published
+#define PUBLISH_INTERVAL_MS (20)
+// How often the diagnostics are published
+#define DIAGNOSTICS_INTERVAL_MS (1000)
+// How long a result waits for room in the queue before it is given up
+#define PUBLISH_TIMEOUT_MS (1000)
+// Smallest change of a measured color or difference that is written
+#define READING_DEADBAND (0.5)
 
-OpcUaServer::OpcUaServer() : serverthread(nullptr), running(false), server(nullptr)
+OpcUaServer::OpcUaServer()
+    : accepting(false), numcolorareas(1), heartbeatinterval(1000), lastheartbeat(0), serverthread(nullptr),
+      running(false), server(nullptr)
 {
+    for (size_t i = 0; i < MAX_REGIONS; i++)
+    {
+        UA_NodeId_init(&nodeids[i]);
+        UA_NodeId_init(&objectids[i]);
+        for (size_t j = 0; j < AreaVariableCount; j++)
+        {
+            UA_NodeId_init(&variableids[i][j]);
+        }
+        valuepublished[i] = false;
+        readingpublished[i] = false;
+    }
+    UA_NodeId_init(&heartbeatnodeid);
+    for (size_t i = 0; i < StageCount; i++)
+    {
+        UA_NodeId_init(&diagnosticids[i][0]);
+        UA_NodeId_init(&diagnosticids[i][1]);
+    }
 }
 
 OpcUaServer::~OpcUaServer()
 {
+    ClearNodeIds();
 }
 
 bool OpcUaServer::LaunchServer(const unsigned int serverport)
@@ -48,9 +101,43 @@ bool OpcUaServer::LaunchServer(const unsigned int serverport)
         return false;
     }
     UA_ServerConfig_setMinimal(UA_Server_getConfig(server), serverport, nullptr);
-    AddBoolean(LABEL, false);
+    ClearNodeIds();
+    AddColorAreaType();
+    for (size_t i = 0; i < numcolorareas; i++)
+    {
+        AddColorArea(i);
+    }
+    char label[LABEL_SIZE];
+    snprintf(label, sizeof(label), "%s", HEARTBEAT_LABEL);
+    heartbeatnodeid = UA_NODEID_STRING_ALLOC(1, label);
+    UA_DateTime now = UA_DateTime_now();
+    AddVariable(
+        heartbeatnodeid,
+        UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+        label,
+        &now,
+        UA_TYPES[UA_TYPES_DATETIME]);
+    AddDiagnostics();
+    lastheartbeat = 0;
+    if (UA_STATUSCODE_GOOD !=
+            UA_Server_addRepeatedCallback(server, PublishResults, this, PUBLISH_INTERVAL_MS, nullptr) ||
+        UA_STATUSCODE_GOOD !=
+            UA_Server_addRepeatedCallback(server, PublishDiagnostics, this, DIAGNOSTICS_INTERVAL_MS, nullptr))
+    {
+        LOG_E("%s/%s: Failed to add publishing callback", __FILE__, __FUNCTION__);
+        UA_Server_delete(server);
+        server = nullptr;
+        return false;
+    }
 
+    // Results queued while no server ran are outdated, and no server thread
+    // can pop concurrently here
+    while (queue.Pop(result))
+    {
+    }
     serverthread = new thread(this->RunUaServer, this);
+    accepting = true;
 
     return true;
 }
@@ -61,6 +148,7 @@ void OpcUaServer::ShutDownServer()
     assert(nullptr != serverthread);
 
     LOG_I("%s/%s: Shutting down UA server ...", __FILE__, __FUNCTION__);
+    accepting = false;
     running = false;
     if (nullptr != serverthread)
     {
@@ -90,70 +178,564 @@ bool OpcUaServer::IsRunning() const
     return running;
 }
 
-void OpcUaServer::UpdateColorAreaValue(bool value)
+/**
+ * brief Set how often the LastEvaluated node is refreshed.
+ *
+ * Can be called from any thread.
+ *
+ * param interval_ms Minimum time between refreshes in ms, 0 disables them.
+ */
+void OpcUaServer::SetHeartbeatInterval(const uint32_t interval_ms)
+{
+    LOG_I("%s/%s: Heartbeat interval set to %u ms", __FILE__, __FUNCTION__, interval_ms);
+    heartbeatinterval = interval_ms;
+}
+
+/**
+ * brief Set the number of color areas exposed by the server.
+ *
+ * The first color area is exposed as ColorAreaReading and ColorArea, any
+ * additional ones as ColorAreaReading1/ColorArea1, ColorAreaReading2/ColorArea2
+ * and so on.
+ *
+ * param count Number of color areas.
+ */
+void OpcUaServer::SetNumColorAreas(const size_t count)
+{
+    assert(0 < count);
+    if (nullptr != server)
+    {
+        for (size_t i = numcolorareas; i < count; i++)
+        {
+            AddColorArea(i);
+        }
+        for (size_t i = count; i < numcolorareas; i++)
+        {
+            RemoveColorArea(i);
+        }
+    }
+    numcolorareas = count;
+}
+
+/**
+ * brief Write a color area value, if it differs from the published one.
+ *
+ * param index Index of the color area.
+ * param value The new value.
+ * param timestamp Time of the evaluation, used as source timestamp.
+ */
+void OpcUaServer::UpdateColorAreaValue(const size_t index, bool value, const UA_DateTime timestamp)
+{
+    if (nullptr == server)
+    {
+        return;
+    }
+    assert(index < numcolorareas);
+    if (valuepublished[index] && publishedvalues[index] == value)
+    {
+        return;
+    }
+    WriteValue(nodeids[index], &value, UA_TYPES[UA_TYPES_BOOLEAN], timestamp);
+    WriteValue(variableids[index][AreaWithinTolerance], &value, UA_TYPES[UA_TYPES_BOOLEAN], timestamp);
+    publishedvalues[index] = value;
+    valuepublished[index] = true;
+    LOG_D("%s/%s: Color area %zu value set to: %s", __FILE__, __FUNCTION__, index, value ? "TRUE" : "FALSE");
+}
+
+/**
+ * brief Write the measurements of a color area to its ColorAreaType object.
+ *
+ * A measurement is only written when it moved at least READING_DEADBAND from
+ * the published one. The frame counter and latency are written along with
+ * any measurement, and otherwise only when refreshed.
+ *
+ * param index Index of the color area.
+ * param timestamp Time of the evaluation, used as source timestamp.
+ * param refresh Whether the frame counter and latency are due anyway.
+ */
+void OpcUaServer::UpdateColorAreaReading(const size_t index, const UA_DateTime timestamp, const bool refresh)
 {
     if (nullptr == server)
     {
         return;
     }
-    // Always update value even if there is no change; that will bump the
-    // timestamp on the server so the client can see if the value is fresh or
-    // ancient.
+    assert(index < numcolorareas);
+    const ColorAreaReading &reading = result.colorareas[index];
+    ColorAreaReading &published = publishedreadings[index];
+    const bool all = !readingpublished[index];
+    UA_NodeId *ids = variableids[index];
+    bool written = all;
+    written |= WriteReading(ids[AreaMeasuredRed], reading.red, published.red, all, timestamp);
+    written |= WriteReading(ids[AreaMeasuredGreen], reading.green, published.green, all, timestamp);
+    written |= WriteReading(ids[AreaMeasuredBlue], reading.blue, published.blue, all, timestamp);
+    written |= WriteReading(ids[AreaDifferenceRed], reading.reddiff, published.reddiff, all, timestamp);
+    written |= WriteReading(ids[AreaDifferenceGreen], reading.greendiff, published.greendiff, all, timestamp);
+    written |= WriteReading(ids[AreaDifferenceBlue], reading.bluediff, published.bluediff, all, timestamp);
+    if (written || refresh)
+    {
+        WriteValue(ids[AreaFrame], &result.frame, UA_TYPES[UA_TYPES_UINT64], timestamp);
+        WriteValue(ids[AreaLatency], &result.latency, UA_TYPES[UA_TYPES_DOUBLE], timestamp);
+    }
+    readingpublished[index] = true;
+}
+
+/**
+ * brief Write a measurement, if it moved at least READING_DEADBAND.
+ *
+ * param id Node of the measurement.
+ * param value The new value.
+ * param published The value last written, updated when writing.
+ * param force Write even if the value did not move.
+ * param timestamp Time of the evaluation, used as source timestamp.
+ * return True if the value was written.
+ */
+bool OpcUaServer::WriteReading(
+    const UA_NodeId &id,
+    double value,
+    double &published,
+    const bool force,
+    const UA_DateTime timestamp)
+{
+    if (!force && READING_DEADBAND > fabs(value - published))
+    {
+        return false;
+    }
+    published = value;
+    WriteValue(id, &value, UA_TYPES[UA_TYPES_DOUBLE], timestamp);
+    return true;
+}
+
+void OpcUaServer::WriteValue(const UA_NodeId &id, void *value, const UA_DataType &type, const UA_DateTime timestamp)
+{
+    UA_DataValue newvalue;
+    UA_DataValue_init(&newvalue);
+    UA_Variant_setScalar(&newvalue.value, value, &type);
+    newvalue.hasValue = true;
+    newvalue.sourceTimestamp = timestamp;
+    newvalue.hasSourceTimestamp = true;
+    const UA_StatusCode status = UA_Server_writeDataValue(server, id, newvalue);
+    if (UA_STATUSCODE_GOOD != status)
+    {
+        LOG_E("%s/%s: Failed to write value: %s", __FILE__, __FUNCTION__, UA_StatusCode_name(status));
+    }
+}
+
+/**
+ * brief Refresh the LastEvaluated node, if the heartbeat interval has passed.
+ *
+ * param timestamp Time of the latest evaluation.
+ * return True if the node was refreshed.
+ */
+bool OpcUaServer::UpdateHeartbeat(const UA_DateTime timestamp)
+{
+    const uint32_t interval = heartbeatinterval;
+    if (nullptr == server || 0 == interval)
+    {
+        return false;
+    }
+    const UA_DateTime now = UA_DateTime_nowMonotonic();
+    if (0 != lastheartbeat && now - lastheartbeat < interval * UA_DATETIME_MSEC)
+    {
+        return false;
+    }
+    UA_DateTime value = timestamp;
     UA_Variant newvalue;
-    UA_Variant_setScalar(&newvalue, &value, &UA_TYPES[UA_TYPES_BOOLEAN]);
-    UA_NodeId currentNodeId = UA_NODEID_STRING(1, LABEL);
-    UA_Server_writeValue(server, currentNodeId, newvalue);
-    LOG_D("%s%s: Color area value set to: %s", __FILE__, __FUNCTION__, value ? "TRUE" : "FALSE");
+    UA_Variant_setScalar(&newvalue, &value, &UA_TYPES[UA_TYPES_DATETIME]);
+    UA_Server_writeValue(server, heartbeatnodeid, newvalue);
+    lastheartbeat = now;
+    return true;
 }
 
-bool OpcUaServer::GetColorAreaValue()
+/**
+ * brief Queue an analysis result for publishing.
+ *
+ * Called from the analysis thread only. If the queue is full the call waits
+ * for the server thread instead of dropping the result, which holds back the
+ * analysis so that the image provider drops stale frames instead. A result
+ * is only given up if no server runs or after PUBLISH_TIMEOUT_MS.
+ *
+ * param result The result.
+ * return True if the result was queued.
+ */
+bool OpcUaServer::Publish(const AnalysisResult &result)
 {
-    assert(nullptr != server);
+    for (uint32_t waited_ms = 0; accepting; waited_ms++)
+    {
+        if (queue.Push(result))
+        {
+            return true;
+        }
+        if (PUBLISH_TIMEOUT_MS <= waited_ms)
+        {
+            LOG_E("%s/%s: Timed out waiting for the server to publish", __FILE__, __FUNCTION__);
+            break;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return false;
+}
 
-    UA_NodeId currentNodeId = UA_NODEID_STRING(1, LABEL);
+/**
+ * brief Write the current result to the address space.
+ */
+void OpcUaServer::PublishResult()
+{
+    if (0 == result.numcolorareas)
+    {
+        return;
+    }
+    if (result.numcolorareas != numcolorareas)
+    {
+        SetNumColorAreas(result.numcolorareas);
+    }
+    const UA_DateTime timestamp = UA_DATETIME_UNIX_EPOCH + result.timestamp * UA_DATETIME_USEC;
+    // The frame counters follow the heartbeat while the readings hold still
+    const bool refresh = UpdateHeartbeat(timestamp);
+    for (size_t i = 0; i < numcolorareas; i++)
+    {
+        UpdateColorAreaValue(i, result.colorareas[i].withintolerance, timestamp);
+        UpdateColorAreaReading(i, timestamp, refresh);
+    }
+}
 
-    UA_Variant value;
-    UA_Variant_init(&value);
-    UA_Server_readValue(server, currentNodeId, &value);
+/**
+ * brief Publish all queued analysis results in order.
+ *
+ * Runs as a repeated callback in the server thread, so the address space
+ * is only ever written from that thread.
+ *
+ * param server The UA server.
+ * param data Pointer to the OpcUaServer.
+ */
+void OpcUaServer::PublishResults(UA_Server *server, void *data)
+{
+    (void)server;
+    assert(nullptr != data);
+    OpcUaServer *parent = static_cast<OpcUaServer *>(data);
 
-    assert(UA_Variant_isScalar(&value));
-    assert(UA_Variant_hasScalarType(&value, &UA_TYPES[UA_TYPES_BOOLEAN]));
+    const int64_t start = Metrics::Now();
+    bool published = false;
+    while (parent->queue.Pop(parent->result))
+    {
+        parent->PublishResult();
+        published = true;
+    }
+    if (published)
+    {
+        Metrics::Record(StageOpcUaWrite, start, Metrics::Now());
+    }
+}
+
+/**
+ * brief Publish the p50 and p99 latencies of the processing stages.
+ *
+ * Runs as a repeated callback in the server thread.
+ *
+ * param server The UA server.
+ * param data Pointer to the OpcUaServer.
+ */
+void OpcUaServer::PublishDiagnostics(UA_Server *server, void *data)
+{
+    (void)server;
+    assert(nullptr != data);
+    OpcUaServer *parent = static_cast<OpcUaServer *>(data);
+
+    const UA_DateTime now = UA_DateTime_now();
+    for (size_t i = 0; i < StageCount; i++)
+    {
+        const LatencyHistogram &histogram = Metrics::Histogram(static_cast<MetricStage>(i));
+        UA_UInt64 p50 = histogram.Percentile(50);
+        UA_UInt64 p99 = histogram.Percentile(99);
+        parent->WriteValue(parent->diagnosticids[i][0], &p50, UA_TYPES[UA_TYPES_UINT64], now);
+        parent->WriteValue(parent->diagnosticids[i][1], &p99, UA_TYPES[UA_TYPES_UINT64], now);
+    }
+}
 
-    bool boolval = *(static_cast<bool *>(value.data));
-    UA_Variant_clear(&value);
+void OpcUaServer::GetColorAreaLabel(const size_t index, char *label, const size_t size)
+{
+    if (0 == index)
+    {
+        snprintf(label, size, "%s", LABEL);
+    }
+    else
+    {
+        snprintf(label, size, "%s%zu", LABEL, index);
+    }
+}
 
-    return boolval;
+void OpcUaServer::GetColorAreaObjectLabel(const size_t index, char *label, const size_t size)
+{
+    if (0 == index)
+    {
+        snprintf(label, size, "%s", OBJECT_LABEL);
+    }
+    else
+    {
+        snprintf(label, size, "%s%zu", OBJECT_LABEL, index);
+    }
 }
 
-void OpcUaServer::AddBoolean(char *label, UA_Boolean value)
+void OpcUaServer::ClearNodeIds()
+{
+    for (size_t i = 0; i < MAX_REGIONS; i++)
+    {
+        UA_NodeId_clear(&nodeids[i]);
+        UA_NodeId_clear(&objectids[i]);
+        for (size_t j = 0; j < AreaVariableCount; j++)
+        {
+            UA_NodeId_clear(&variableids[i][j]);
+        }
+        valuepublished[i] = false;
+        readingpublished[i] = false;
+    }
+    UA_NodeId_clear(&heartbeatnodeid);
+    for (size_t i = 0; i < StageCount; i++)
+    {
+        UA_NodeId_clear(&diagnosticids[i][0]);
+        UA_NodeId_clear(&diagnosticids[i][1]);
+    }
+}
+
+/**
+ * brief Add a scalar read-only variable node.
+ *
+ * param id Node id of the new node.
+ * param parent Node id of the parent node.
+ * param reference Reference type from the parent to the new node.
+ * param label Browse name and display name of the new node.
+ * param value Pointer to the initial value.
+ * param type Data type of the value.
+ * return True if the node was added.
+ */
+bool OpcUaServer::AddVariable(
+    const UA_NodeId &id,
+    const UA_NodeId &parent,
+    const UA_NodeId &reference,
+    char *label,
+    void *value,
+    const UA_DataType &type)
 {
     assert(nullptr != server);
     assert(nullptr != label);
+    assert(nullptr != value);
 
     // Define attributes
     char *enUS = (char *)"en-US";
     UA_VariableAttributes attr = UA_VariableAttributes_default;
-    UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    UA_Variant_setScalar(&attr.value, value, &type);
     attr.description = UA_LOCALIZEDTEXT(enUS, label);
     attr.displayName = UA_LOCALIZEDTEXT(enUS, label);
-    attr.dataType = UA_TYPES[UA_TYPES_BOOLEAN].typeId;
+    attr.dataType = type.typeId;
     attr.accessLevel = UA_ACCESSLEVELMASK_READ;
 
     // Add the variable node to the information model
-    UA_NodeId node_id = UA_NODEID_STRING(1, label);
     UA_QualifiedName name = UA_QUALIFIEDNAME(1, label);
-    UA_NodeId parent_node_id = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
-    UA_NodeId parent_ref_node_id = UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES);
-    UA_Server_addVariableNode(
+    const UA_StatusCode status = UA_Server_addVariableNode(
         server,
-        node_id,
-        parent_node_id,
-        parent_ref_node_id,
+        id,
+        parent,
+        reference,
         name,
         UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
         attr,
         nullptr,
         nullptr);
+    if (UA_STATUSCODE_GOOD != status)
+    {
+        LOG_E("%s/%s: Failed to add %s: %s", __FILE__, __FUNCTION__, label, UA_StatusCode_name(status));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * brief Add the ColorAreaType object type to the information model.
+ *
+ * The variables are declared optional, so open62541 does not instantiate
+ * them with generated node ids; each color area object adds its own
+ * variables with the same browse names and known node ids instead.
+ */
+void OpcUaServer::AddColorAreaType()
+{
+    assert(nullptr != server);
+
+    char *enUS = (char *)"en-US";
+    char label[LABEL_SIZE];
+    snprintf(label, sizeof(label), "%s", OBJECT_TYPE_LABEL);
+    UA_ObjectTypeAttributes attr = UA_ObjectTypeAttributes_default;
+    attr.description = UA_LOCALIZEDTEXT(enUS, label);
+    attr.displayName = UA_LOCALIZEDTEXT(enUS, label);
+    const UA_NodeId type_id = UA_NODEID_STRING(1, label);
+    UA_Server_addObjectTypeNode(
+        server,
+        type_id,
+        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
+        UA_QUALIFIEDNAME(1, label),
+        attr,
+        nullptr,
+        nullptr);
+
+    for (size_t i = 0; i < AreaVariableCount; i++)
+    {
+        char varlabel[LABEL_SIZE];
+        snprintf(varlabel, sizeof(varlabel), "%s", AREA_VARIABLES[i].name);
+        char idlabel[2 * LABEL_SIZE];
+        snprintf(idlabel, sizeof(idlabel), "%s.%s", OBJECT_TYPE_LABEL, AREA_VARIABLES[i].name);
+        const UA_NodeId var_id = UA_NODEID_STRING(1, idlabel);
+        // All variable types used are at most 8 bytes large
+        uint64_t zero = 0;
+        if (AddVariable(
+                var_id,
+                type_id,
+                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                varlabel,
+                &zero,
+                UA_TYPES[AREA_VARIABLES[i].type]))
+        {
+            UA_Server_addReference(
+                server,
+                var_id,
+                UA_NODEID_NUMERIC(0, UA_NS0ID_HASMODELLINGRULE),
+                UA_EXPANDEDNODEID_NUMERIC(0, UA_NS0ID_MODELLINGRULE_OPTIONAL),
+                true);
+        }
+    }
+}
+
+/**
+ * brief Add the Diagnostics object with the stage latency variables.
+ *
+ * For each processing stage there is a <Stage>P50 and a <Stage>P99 variable
+ * holding the latency percentiles in us.
+ */
+void OpcUaServer::AddDiagnostics()
+{
+    assert(nullptr != server);
+
+    char *enUS = (char *)"en-US";
+    char label[LABEL_SIZE];
+    snprintf(label, sizeof(label), "%s", DIAGNOSTICS_LABEL);
+    const UA_NodeId object_id = UA_NODEID_STRING(1, label);
+    UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+    attr.description = UA_LOCALIZEDTEXT(enUS, label);
+    attr.displayName = UA_LOCALIZEDTEXT(enUS, label);
+    UA_Server_addObjectNode(
+        server,
+        object_id,
+        UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+        UA_QUALIFIEDNAME(1, label),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
+        attr,
+        nullptr,
+        nullptr);
+
+    const char *suffixes[2] = {"P50", "P99"};
+    for (size_t i = 0; i < StageCount; i++)
+    {
+        for (size_t j = 0; j < 2; j++)
+        {
+            char varlabel[LABEL_SIZE];
+            snprintf(varlabel, sizeof(varlabel), "%s%s", Metrics::StageName(static_cast<MetricStage>(i)), suffixes[j]);
+            char idlabel[2 * LABEL_SIZE];
+            snprintf(idlabel, sizeof(idlabel), "%s.%s", DIAGNOSTICS_LABEL, varlabel);
+            diagnosticids[i][j] = UA_NODEID_STRING_ALLOC(1, idlabel);
+            UA_UInt64 zero = 0;
+            AddVariable(
+                diagnosticids[i][j],
+                object_id,
+                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                varlabel,
+                &zero,
+                UA_TYPES[UA_TYPES_UINT64]);
+        }
+    }
+}
+
+/**
+ * brief Add the nodes of a color area.
+ *
+ * param index Index of the color area.
+ */
+void OpcUaServer::AddColorArea(const size_t index)
+{
+    assert(nullptr != server);
+    assert(MAX_REGIONS > index);
+
+    char label[LABEL_SIZE];
+    GetColorAreaLabel(index, label, sizeof(label));
+    nodeids[index] = UA_NODEID_STRING_ALLOC(1, label);
+    UA_Boolean value = false;
+    AddVariable(
+        nodeids[index],
+        UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+        label,
+        &value,
+        UA_TYPES[UA_TYPES_BOOLEAN]);
+    valuepublished[index] = false;
+    readingpublished[index] = false;
+
+    char *enUS = (char *)"en-US";
+    char objlabel[LABEL_SIZE];
+    GetColorAreaObjectLabel(index, objlabel, sizeof(objlabel));
+    objectids[index] = UA_NODEID_STRING_ALLOC(1, objlabel);
+    UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+    attr.description = UA_LOCALIZEDTEXT(enUS, objlabel);
+    attr.displayName = UA_LOCALIZEDTEXT(enUS, objlabel);
+    char typelabel[LABEL_SIZE];
+    snprintf(typelabel, sizeof(typelabel), "%s", OBJECT_TYPE_LABEL);
+    UA_Server_addObjectNode(
+        server,
+        objectids[index],
+        UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+        UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+        UA_QUALIFIEDNAME(1, objlabel),
+        UA_NODEID_STRING(1, typelabel),
+        attr,
+        nullptr,
+        nullptr);
+
+    for (size_t i = 0; i < AreaVariableCount; i++)
+    {
+        char varlabel[LABEL_SIZE];
+        snprintf(varlabel, sizeof(varlabel), "%s", AREA_VARIABLES[i].name);
+        char idlabel[2 * LABEL_SIZE];
+        snprintf(idlabel, sizeof(idlabel), "%s.%s", objlabel, AREA_VARIABLES[i].name);
+        variableids[index][i] = UA_NODEID_STRING_ALLOC(1, idlabel);
+        uint64_t zero = 0;
+        AddVariable(
+            variableids[index][i],
+            objectids[index],
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            varlabel,
+            &zero,
+            UA_TYPES[AREA_VARIABLES[i].type]);
+    }
+}
+
+/**
+ * brief Remove the nodes of a color area.
+ *
+ * param index Index of the color area.
+ */
+void OpcUaServer::RemoveColorArea(const size_t index)
+{
+    assert(nullptr != server);
+    assert(MAX_REGIONS > index);
+
+    UA_Server_deleteNode(server, nodeids[index], true);
+    UA_NodeId_clear(&nodeids[index]);
+    for (size_t i = 0; i < AreaVariableCount; i++)
+    {
+        UA_Server_deleteNode(server, variableids[index][i], true);
+        UA_NodeId_clear(&variableids[index][i]);
+    }
+    UA_Server_deleteNode(server, objectids[index], true);
+    UA_NodeId_clear(&objectids[index]);
+    valuepublished[index] = false;
+    readingpublished[index] = false;
 }
 
 void OpcUaServer::RunUaServer(OpcUaServer *parent)
@@ -0,0 +1,497 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <sstream>
+#include <stdexcept>
+
+#include "common.hpp"
+#include "regionset.hpp"
+
+using namespace cv;
+using namespace std;
+
+RegionSet::RegionSet(const cv::Size &img_size, const vector<RegionSpec> &specs)
+    : bands((img_size.height + REGION_BAND_ROWS - 1) / REGION_BAND_ROWS), sums(specs.size()), img_size(img_size),
+      strategy(StrategyAuto), tilerows(0), tiles(0)
+{
+    assert(MAX_REGIONS >= specs.size());
+
+    for (auto &spec : specs)
+    {
+        regions.push_back(CreateColorArea(img_size, spec));
+        shapes.push_back(spec.markershape);
+    }
+    PlanTasks();
+}
+
+RegionSet::~RegionSet()
+{
+    for (auto region : regions)
+    {
+        delete region;
+    }
+}
+
+size_t RegionSet::Size() const
+{
+    return regions.size();
+}
+
+const ColorArea &RegionSet::Region(const size_t index) const
+{
+    assert(index < regions.size());
+    return *regions[index];
+}
+
+void RegionSet::SetTarget(const size_t index, const cv::Scalar &color, const uint8_t tolerance)
+{
+    assert(index < regions.size());
+    regions[index]->SetTarget(color, tolerance);
+}
+
+void RegionSet::SetMetric(const ColorMetricType type)
+{
+    for (auto region : regions)
+    {
+        region->SetMetric(type);
+    }
+}
+
+/**
+ * brief Choose how to evaluate the rectangles.
+ *
+ * Plans the tasks again, so it should be called before the first frame.
+ */
+void RegionSet::SetStrategy(const EvaluationStrategy strategy)
+{
+    this->strategy = strategy;
+    PlanTasks();
+}
+
+bool RegionSet::UsesSummedArea() const
+{
+    return !tableregions.empty();
+}
+
+/**
+ * brief Set up the summed-area table, if used, and group the bands of the
+ * other regions into tasks of about REGION_TASK_PIXELS pixels.
+ *
+ * The pixels of a region are estimated from its bounding box.
+ */
+void RegionSet::PlanTasks()
+{
+    // A table pays off when the rectangles cover the box many times over
+    tableregions.clear();
+    tablebox = Rect();
+    size_t rectpixels = 0;
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        const Range rows = regions[i]->GetRowRange();
+        const Range columns = regions[i]->GetColumnRange();
+        if (Rectangle == shapes[i] && !rows.empty() && !columns.empty())
+        {
+            tablebox |= Rect(columns.start, rows.start, columns.size(), rows.size());
+            rectpixels += rows.size() * columns.size();
+            tableregions.push_back(i);
+        }
+    }
+    const size_t boxpixels = tablebox.area();
+    bool usetable = !tableregions.empty() && (StrategySummedArea == strategy ||
+                                              (StrategyAuto == strategy && SAT_COST_FACTOR * boxpixels < rectpixels));
+    if (usetable && SAT_MAX_PIXELS < boxpixels)
+    {
+        LOG_I(
+            "%s/%s: Rectangles span %zu pixels, too many for a summed-area table (max %u)",
+            __FILE__,
+            __FUNCTION__,
+            boxpixels,
+            SAT_MAX_PIXELS);
+        usetable = false;
+    }
+    if (!usetable)
+    {
+        tableregions.clear();
+        tablebox = Rect();
+    }
+    tilerows = usetable ? max(1, REGION_TASK_PIXELS / tablebox.width) : 0;
+    tiles = usetable ? (tablebox.height + tilerows - 1) / tilerows : 0;
+    table.assign(usetable ? 3 * (tablebox.height + 1) * (tablebox.width + 1) : 0, 0);
+    tileoffsets.assign(3 * tiles * (tablebox.width + 1), 0);
+
+    // Sort the other regions into the bands they cover
+    for (auto &band : bands)
+    {
+        band.clear();
+    }
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        const Range rows = regions[i]->GetRowRange();
+        if (rows.empty() || tableregions.end() != find(tableregions.begin(), tableregions.end(), i))
+        {
+            continue;
+        }
+        const size_t firstband = rows.start / REGION_BAND_ROWS;
+        const size_t lastband = (rows.end - 1) / REGION_BAND_ROWS;
+        for (size_t band = firstband; band <= lastband && band < bands.size(); band++)
+        {
+            bands[band].push_back(i);
+        }
+    }
+
+    tasks.clear();
+    size_t taskpixels = 0;
+    for (size_t band = 0; band < bands.size(); band++)
+    {
+        if (bands[band].empty())
+        {
+            continue;
+        }
+        if (tasks.empty() || REGION_TASK_PIXELS <= taskpixels)
+        {
+            BandTask task;
+            task.firstband = band;
+            task.endband = band + 1;
+            tasks.push_back(task);
+            taskpixels = 0;
+        }
+        BandTask &task = tasks.back();
+        task.endband = band + 1;
+        const int firstrow = band * REGION_BAND_ROWS;
+        const int endrow = min(firstrow + REGION_BAND_ROWS, img_size.height);
+        for (auto i : bands[band])
+        {
+            const Range rows = regions[i]->GetRowRange();
+            taskpixels += (min(rows.end, endrow) - max(rows.start, firstrow)) * regions[i]->GetColumnRange().size();
+            if (find(task.regions.begin(), task.regions.end(), i) == task.regions.end())
+            {
+                task.regions.push_back(i);
+            }
+        }
+    }
+    tasksums.resize(tasks.size() * regions.size());
+
+    LOG_I(
+        "%s/%s: Region set with %zu color areas in %zu tasks and %zu table tiles",
+        __FILE__,
+        __FUNCTION__,
+        regions.size(),
+        tasks.size(),
+        tiles);
+}
+
+/**
+ * brief Build one tile of the summed-area table.
+ *
+ * Like SumRowNV12(), every luma pixel is counted with the UV pair of its 2x2
+ * block, so a lookup gives the same sums as summing the rows.
+ *
+ * param nv12_img The frame.
+ * param tile Index of the tile, whose rows of the table are only written here.
+ */
+void RegionSet::BuildTableTile(const Mat &nv12_img, const size_t tile)
+{
+    const size_t stride = 3 * (tablebox.width + 1);
+    const size_t firstrow = tile * tilerows;
+    const size_t endrow = min<size_t>(firstrow + tilerows, tablebox.height);
+    for (size_t row = firstrow; row < endrow; row++)
+    {
+        const int framerow = tablebox.y + row;
+        const uint8_t *y_row = nv12_img.ptr<uint8_t>(framerow) + tablebox.x;
+        const uint8_t *uv_row = nv12_img.ptr<uint8_t>(img_size.height + framerow / 2);
+        uint32_t *entry = &table[(row + 1) * stride];
+        // The tile starts from zero, the rows above are in the tile offsets.
+        // The first row of the table is never written, so it is all zero.
+        const uint32_t *above = (firstrow == row) ? &table[0] : entry - stride;
+        uint32_t sum_y = 0;
+        uint32_t sum_u = 0;
+        uint32_t sum_v = 0;
+        for (int column = 0; column < tablebox.width; column++)
+        {
+            const int uv = (tablebox.x + column) & ~1;
+            sum_y += y_row[column];
+            sum_u += uv_row[uv];
+            sum_v += uv_row[uv + 1];
+            const int next = 3 * (column + 1);
+            entry[next] = sum_y + above[next];
+            entry[next + 1] = sum_u + above[next + 1];
+            entry[next + 2] = sum_v + above[next + 2];
+        }
+    }
+}
+
+/**
+ * brief Get the Y, U and V sums of the box pixels above and left of an entry.
+ *
+ * param row Rows of the box above the entry, 0 to the box height.
+ * param column Columns of the box left of the entry, 0 to the box width.
+ * param yuv Set to the three sums.
+ */
+void RegionSet::TableSums(const size_t row, const size_t column, uint32_t *yuv) const
+{
+    if (0 == row)
+    {
+        yuv[0] = yuv[1] = yuv[2] = 0;
+        return;
+    }
+    const size_t stride = 3 * (tablebox.width + 1);
+    const uint32_t *entry = &table[row * stride + 3 * column];
+    const uint32_t *offset = &tileoffsets[(row - 1) / tilerows * stride + 3 * column];
+    for (int c = 0; c < 3; c++)
+    {
+        yuv[c] = entry[c] + offset[c];
+    }
+}
+
+/**
+ * brief Get the sums of a rectangle from the summed-area table.
+ *
+ * param index Index of the region.
+ * param regionsums Set to the sums of the region.
+ */
+void RegionSet::LookUpTable(const size_t index, YuvSums &regionsums) const
+{
+    const Range rows = regions[index]->GetRowRange();
+    const Range columns = regions[index]->GetColumnRange();
+    const size_t top = rows.start - tablebox.y;
+    const size_t bottom = rows.end - tablebox.y;
+    const size_t left = columns.start - tablebox.x;
+    const size_t right = columns.end - tablebox.x;
+    uint32_t topleft[3], topright[3], bottomleft[3], bottomright[3];
+    TableSums(top, left, topleft);
+    TableSums(top, right, topright);
+    TableSums(bottom, left, bottomleft);
+    TableSums(bottom, right, bottomright);
+    // The sums fit 32 bits for any frame, so wrapping differences are exact
+    regionsums.y = bottomright[0] - bottomleft[0] - topright[0] + topleft[0];
+    regionsums.u = bottomright[1] - bottomleft[1] - topright[1] + topleft[1];
+    regionsums.v = bottomright[2] - bottomleft[2] - topright[2] + topleft[2];
+    regionsums.count = rows.size() * columns.size();
+}
+
+/**
+ * brief Sum the pixels of the regions in the bands of one task.
+ *
+ * param nv12_img The frame.
+ * param task Index of the task, whose sums are only written here.
+ */
+void RegionSet::EvaluateTask(const Mat &nv12_img, const size_t task)
+{
+    const BandTask &bandtask = tasks[task];
+    YuvSums *partial = &tasksums[task * regions.size()];
+    for (auto i : bandtask.regions)
+    {
+        partial[i] = {0, 0, 0, 0};
+    }
+
+    // Sweep the bands top to bottom
+    for (size_t band = bandtask.firstband; band < bandtask.endband; band++)
+    {
+        const auto &bandregions = bands[band];
+        if (bandregions.empty())
+        {
+            continue;
+        }
+        const int firstrow = band * REGION_BAND_ROWS;
+        const int endrow = min(firstrow + REGION_BAND_ROWS, img_size.height);
+        for (auto i : bandregions)
+        {
+            regions[i]->SumRows(nv12_img, firstrow, endrow, partial[i]);
+        }
+    }
+}
+
+/**
+ * brief Evaluate all color areas on a frame.
+ *
+ * Allocates no memory as long as results has room for all color areas,
+ * e.g. by reserving MAX_REGIONS entries up front.
+ *
+ * param nv12_img The frame.
+ * param results One result per color area, in order.
+ * param pool Pool to run the tasks in parallel on, or nullptr to run them on
+ *        the calling thread.
+ */
+void RegionSet::Evaluate(const Mat &nv12_img, vector<RegionResult> &results, TaskPool *pool)
+{
+    assert(img_size.width == nv12_img.cols);
+    assert(img_size.height * 3 / 2 == nv12_img.rows);
+
+    // The table tiles are tasks after the band tasks
+    auto evaluatetask = [this, &nv12_img](const size_t task)
+    {
+        if (task < tasks.size())
+        {
+            EvaluateTask(nv12_img, task);
+        }
+        else
+        {
+            BuildTableTile(nv12_img, task - tasks.size());
+        }
+    };
+    if (nullptr != pool)
+    {
+        pool->Run(tasks.size() + tiles, evaluatetask);
+    }
+    else
+    {
+        for (size_t task = 0; task < tasks.size() + tiles; task++)
+        {
+            evaluatetask(task);
+        }
+    }
+
+    // Add up the sums of the tasks, which are all done
+    for (auto &sum : sums)
+    {
+        sum = {0, 0, 0, 0};
+    }
+    for (size_t task = 0; task < tasks.size(); task++)
+    {
+        const YuvSums *partial = &tasksums[task * regions.size()];
+        for (auto i : tasks[task].regions)
+        {
+            sums[i].y += partial[i].y;
+            sums[i].u += partial[i].u;
+            sums[i].v += partial[i].v;
+            sums[i].count += partial[i].count;
+        }
+    }
+    if (UsesSummedArea())
+    {
+        // Each tile offset adds the last row of the tile above to its offset
+        const size_t stride = 3 * (tablebox.width + 1);
+        for (size_t tile = 1; tile < tiles; tile++)
+        {
+            const uint32_t *lastrow = &table[tile * tilerows * stride];
+            const uint32_t *above = &tileoffsets[(tile - 1) * stride];
+            uint32_t *offset = &tileoffsets[tile * stride];
+            for (size_t i = 0; i < stride; i++)
+            {
+                offset[i] = above[i] + lastrow[i];
+            }
+        }
+        for (auto i : tableregions)
+        {
+            LookUpTable(i, sums[i]);
+        }
+    }
+
+    results.resize(regions.size());
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        results[i].average = ColorArea::AverageColor(sums[i]);
+        results[i].withintolerance = regions[i]->WithinTolerance(results[i].average);
+    }
+}
+
+ColorArea *RegionSet::CreateColorArea(const cv::Size &img_size, const RegionSpec &spec)
+{
+    switch (spec.markershape)
+    {
+    case Ellipse:
+        return new ColorAreaEllipse(
+            img_size,
+            spec.center,
+            spec.color,
+            spec.markerwidth,
+            spec.markerheight,
+            spec.tolerance);
+    case Rectangle:
+        return new ColorAreaRectangle(
+            img_size,
+            spec.center,
+            spec.color,
+            spec.markerwidth,
+            spec.markerheight,
+            spec.tolerance);
+    default:
+        throw runtime_error("Unknown marker shape value used.");
+    }
+}
+
+/**
+ * brief Parse a region list.
+ *
+ * Regions are separated by ';' and each region is given as
+ * shape,centerx,centery,markerwidth,markerheight,colorr,colorg,colorb,tolerance
+ * optionally followed by ,channel (DEFAULT_CHANNEL if left out),
+ * e.g. "0,100,170,25,25,50,50,50,35;1,300,170,40,20,200,10,10,20,2".
+ *
+ * param str String to parse.
+ * param bounds Resolution the coordinates are given in, the centers must be
+ *        inside it.
+ * param specs Parsed regions are appended here.
+ * return False if the string is malformed, otherwise true.
+ */
+bool RegionSet::ParseRegions(const string &str, const cv::Size &bounds, vector<RegionSpec> &specs)
+{
+    istringstream regionstream(str);
+    string regionstr;
+    vector<RegionSpec> parsed;
+    while (getline(regionstream, regionstr, ';'))
+    {
+        if (regionstr.find_first_not_of(" \t") == string::npos)
+        {
+            continue;
+        }
+        istringstream valuestream(regionstr);
+        double values[9];
+        char separator;
+        for (size_t i = 0; i < 9; i++)
+        {
+            if (!(valuestream >> values[i]) || (8 > i && (!(valuestream >> separator) || ',' != separator)))
+            {
+                LOG_E("%s/%s: Malformed region '%s'", __FILE__, __FUNCTION__, regionstr.c_str());
+                return false;
+            }
+        }
+        // An optional tenth value gives the channel
+        double channel = DEFAULT_CHANNEL;
+        if (valuestream >> separator && (',' != separator || !(valuestream >> channel)))
+        {
+            LOG_E("%s/%s: Malformed region '%s'", __FILE__, __FUNCTION__, regionstr.c_str());
+            return false;
+        }
+        if (MarkerCount <= values[0] || 0 > values[0] || 0 > values[1] || bounds.width <= values[1] || 0 > values[2] ||
+            bounds.height <= values[2] || 1 > values[3] || 1 > values[4] || 0 > values[5] || 255 < values[5] ||
+            0 > values[6] || 255 < values[6] || 0 > values[7] || 255 < values[7] || 0 > values[8] || 255 < values[8] ||
+            1 > channel || MAX_CHANNELS < channel)
+        {
+            LOG_E("%s/%s: Region value out of range in '%s'", __FILE__, __FUNCTION__, regionstr.c_str());
+            return false;
+        }
+        RegionSpec spec;
+        spec.markershape = values[0];
+        spec.center = Point(values[1], values[2]);
+        spec.markerwidth = values[3];
+        spec.markerheight = values[4];
+        spec.color = Scalar(values[7], values[6], values[5]);
+        spec.tolerance = values[8];
+        spec.channel = channel;
+        parsed.push_back(spec);
+    }
+    if (MAX_REGIONS < specs.size() + parsed.size())
+    {
+        LOG_E("%s/%s: Too many regions (max %u)", __FILE__, __FUNCTION__, MAX_REGIONS);
+        return false;
+    }
+    specs.insert(specs.end(), parsed.begin(), parsed.end());
+
+    return true;
+}
@@ -0,0 +1,106 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+
+#include "statefilter.hpp"
+
+using namespace cv;
+
+StateFilter::StateFilter() : alpha(1.0), hysteresis(0.0), mindwell_us(0), candidatesince(0), primed(false), state(false)
+{
+}
+
+/**
+ * brief Change the filter settings, keeping the current state.
+ *
+ * param config New settings.
+ */
+void StateFilter::Configure(const FilterConfig &config)
+{
+    // An EMA with alpha 2 / (N + 1) has the same center of mass as an N frame
+    // boxcar average
+    alpha = 2.0 / (1.0 + (0 < config.smoothingframes ? config.smoothingframes : 1));
+    hysteresis = config.hysteresis;
+    mindwell_us = static_cast<int64_t>(config.mindwell_ms) * 1000;
+}
+
+/**
+ * brief Forget the history, e.g. when the color area has moved.
+ */
+void StateFilter::Reset()
+{
+    candidatesince = 0;
+    primed = false;
+    state = false;
+}
+
+/**
+ * brief Add an average color to the moving average.
+ *
+ * param average Average color of the latest frame.
+ * return The smoothed average color.
+ */
+const Scalar &StateFilter::Smooth(const Scalar &average)
+{
+    if (!primed)
+    {
+        smoothed = average;
+        return smoothed;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        smoothed.val[i] += alpha * (average.val[i] - smoothed.val[i]);
+    }
+    return smoothed;
+}
+
+/**
+ * brief Update the within tolerance state.
+ *
+ * param deviation Deviation of the smoothed color from the target.
+ * param tolerance Tolerance of the color area.
+ * param now_us Time of the frame in microseconds.
+ * return The filtered state.
+ */
+bool StateFilter::Update(const double deviation, const double tolerance, const int64_t now_us)
+{
+    const bool candidate = deviation < (state ? tolerance + hysteresis : tolerance);
+    if (!primed)
+    {
+        // The first frame is reported as it is
+        primed = true;
+        state = candidate;
+        return state;
+    }
+    if (candidate == state)
+    {
+        candidatesince = 0;
+        return state;
+    }
+
+    if (0 == candidatesince)
+    {
+        candidatesince = now_us;
+    }
+    if (now_us - candidatesince >= mindwell_us)
+    {
+        state = candidate;
+        candidatesince = 0;
+    }
+
+    return state;
+}
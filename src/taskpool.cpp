@@ -0,0 +1,177 @@
+/**
+ * Copyright (C) 2023, Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <assert.h>
+
+#include "common.hpp"
+#include "taskpool.hpp"
+
+using namespace std;
+
+/**
+ * brief Constructor, starts the worker threads.
+ *
+ * param numworkers Number of threads besides the calling thread, at most
+ *        MAX_POOL_THREADS - 1.
+ */
+TaskPool::TaskPool(const size_t numworkers)
+    : maxthreads(MAX_POOL_THREADS), generation(0), participants(0), pending(0), stopping(false), call(nullptr),
+      function(nullptr)
+{
+    const size_t count = min<size_t>(numworkers, MAX_POOL_THREADS - 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        workers.push_back(thread(&TaskPool::WorkerEntry, this, i + 1));
+    }
+    LOG_I("%s/%s: Task pool with %zu worker threads started", __FILE__, __FUNCTION__, workers.size());
+}
+
+TaskPool::~TaskPool()
+{
+    wakemtx.lock();
+    stopping = true;
+    wakemtx.unlock();
+    wake.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * brief Limit the number of threads running the tasks of a Run().
+ *
+ * Takes effect at the next Run(). The workers above the limit sleep.
+ *
+ * param maxthreads Number of threads, the caller included, 0 for all.
+ */
+void TaskPool::SetMaxThreads(const size_t maxthreads)
+{
+    this->maxthreads = (0 == maxthreads) ? MAX_POOL_THREADS : maxthreads;
+}
+
+size_t TaskPool::MaxThreads() const
+{
+    return min(maxthreads.load(), workers.size() + 1);
+}
+
+/**
+ * brief Get the number of workers that, with the calling thread, give one
+ * thread per core.
+ */
+size_t TaskPool::DefaultWorkers()
+{
+    const unsigned int cores = thread::hardware_concurrency();
+    return (1 < cores) ? cores - 1 : 0;
+}
+
+void TaskPool::RunTasks(const size_t count, TaskFunction call, void *function)
+{
+    unique_lock<mutex> runlock(runmtx, try_to_lock);
+    const size_t threads = min(MaxThreads(), count);
+    if (!runlock.owns_lock() || 1 >= threads)
+    {
+        for (size_t task = 0; task < count; task++)
+        {
+            call(function, task);
+        }
+        return;
+    }
+
+    // Split the tasks evenly, the ranges are evened out by stealing
+    for (size_t i = 0; i < threads; i++)
+    {
+        ranges[i].next = count * i / threads;
+        ranges[i].end = count * (i + 1) / threads;
+    }
+    wakemtx.lock();
+    this->call = call;
+    this->function = function;
+    participants = threads;
+    pending = threads - 1;
+    generation++;
+    wakemtx.unlock();
+    wake.notify_all();
+
+    TakeTasks(0);
+
+    unique_lock<mutex> lock(wakemtx);
+    while (0 != pending)
+    {
+        done.wait(lock);
+    }
+}
+
+/**
+ * brief Run tasks until all ranges are empty, starting with the own range.
+ *
+ * param self Index of the range of this thread.
+ */
+void TaskPool::TakeTasks(const size_t self)
+{
+    for (size_t i = 0; i < participants; i++)
+    {
+        TaskRange &range = ranges[(self + i) % participants];
+        for (;;)
+        {
+            const size_t task = range.next.fetch_add(1);
+            if (task >= range.end)
+            {
+                break;
+            }
+            call(function, task);
+        }
+    }
+}
+
+/**
+ * brief Starting point function for the worker threads.
+ *
+ * A worker wakes up for each Run() and takes part if its index is below the
+ * number of threads of that Run().
+ *
+ * param self Index of the worker, the calling thread of Run() is 0.
+ */
+void TaskPool::WorkerEntry(const size_t self)
+{
+    uint64_t seen = 0;
+    unique_lock<mutex> lock(wakemtx);
+    for (;;)
+    {
+        while (!stopping && seen == generation)
+        {
+            wake.wait(lock);
+        }
+        if (stopping)
+        {
+            return;
+        }
+        seen = generation;
+        if (self >= participants)
+        {
+            continue;
+        }
+
+        lock.unlock();
+        TakeTasks(self);
+        lock.lock();
+        if (0 == --pending)
+        {
+            done.notify_one();
+        }
+    }
+}